@@ -0,0 +1,225 @@
+/*
+ * persistent directory listing cache
+ *
+ * This work is licensed under the terms of any of these licenses
+ * (at your option):
+ *  - GNU GPL, version 2 or later.
+ *  - GNU LGPL, version 2.1 or later.
+ *  - MAME license.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "posix.h"
+#include "plat.h"
+#include "fastmem.h"
+#include "dircache.h"
+
+#define DIRCACHE_MAGIC "PFDC"
+#define DIRCACHE_VERSION 1
+
+/* file layout: header, entries[count], dir path + \0, names */
+struct dircache_hdr {
+	char magic[4];
+	unsigned int version;
+	unsigned long long key;
+	unsigned long long dev;
+	unsigned long long ino;
+	long long mtime;
+	unsigned int mtime_ns;
+	unsigned int count;
+	unsigned int path_len;
+	unsigned int names_size;
+};
+
+struct dircache_ent {
+	unsigned int name_ofs;
+	unsigned int type;
+};
+
+static int dircache_fname(char *buf, int size, const char *dir,
+	unsigned long long key)
+{
+	unsigned long long h = fastmem_hash(dir, strlen(dir));
+	int pos;
+
+	pos = plat_get_root_dir(buf, size);
+	if (pos + 32 > size)
+		return -1;
+	snprintf(buf + pos, size - pos, "dircache");
+	mkdir(buf, 0755);
+	snprintf(buf + pos, size - pos, "dircache/%016llx.bin",
+		h ^ (key * 0x9e3779b97f4a7c15ull));
+	return 0;
+}
+
+static void dircache_fill_stat(struct dircache_hdr *hdr, const struct stat *st)
+{
+	hdr->dev = st->st_dev;
+	hdr->ino = st->st_ino;
+	hdr->mtime = st->st_mtime;
+#ifdef __linux__
+	hdr->mtime_ns = st->st_mtim.tv_nsec;
+#endif
+}
+
+int dircache_load(const char *dir, unsigned long long key,
+	struct dirent ***namelist_out)
+{
+	const struct dircache_hdr *hdr;
+	const struct dircache_ent *ents;
+	struct dircache_hdr cur;
+	struct dirent **namelist = NULL;
+	const char *path, *names;
+	struct stat st;
+	char fname[512];
+	size_t size = 0, len;
+	void *map = MAP_FAILED;
+	int fd = -1, ret = -1;
+	unsigned int i;
+
+	if (stat(dir, &st) != 0)
+		return -1;
+	memset(&cur, 0, sizeof(cur));
+	dircache_fill_stat(&cur, &st);
+
+	if (dircache_fname(fname, sizeof(fname), dir, key) != 0)
+		return -1;
+	fd = open(fname, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*hdr))
+		goto out;
+	size = st.st_size;
+	map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto out;
+
+	hdr = map;
+	if (memcmp(hdr->magic, DIRCACHE_MAGIC, 4) != 0
+	    || hdr->version != DIRCACHE_VERSION || hdr->key != key
+	    || hdr->dev != cur.dev || hdr->ino != cur.ino
+	    || hdr->mtime != cur.mtime || hdr->mtime_ns != cur.mtime_ns)
+		goto out;
+	if (sizeof(*hdr) + (size_t)hdr->count * sizeof(*ents)
+	    + hdr->path_len + 1 + hdr->names_size != size)
+		goto out;
+
+	ents = (const void *)(hdr + 1);
+	path = (const char *)(ents + hdr->count);
+	names = path + hdr->path_len + 1;
+	if (hdr->path_len != strlen(dir) || memcmp(path, dir, hdr->path_len) != 0)
+		goto out; // hash collision
+	if (hdr->names_size == 0 || names[hdr->names_size - 1] != 0)
+		goto out;
+
+	namelist = calloc(hdr->count + 1, sizeof(namelist[0]));
+	if (namelist == NULL)
+		goto out;
+	for (i = 0; i < hdr->count; i++) {
+		if (ents[i].name_ofs >= hdr->names_size)
+			goto out;
+		len = strlen(names + ents[i].name_ofs);
+		namelist[i] = calloc(1, offsetof(struct dirent, d_name) + len + 1);
+		if (namelist[i] == NULL)
+			goto out;
+		namelist[i]->d_type = ents[i].type;
+		memcpy(namelist[i]->d_name, names + ents[i].name_ofs, len + 1);
+	}
+
+	*namelist_out = namelist;
+	namelist = NULL;
+	ret = hdr->count;
+
+out:
+	if (namelist != NULL) {
+		for (i = 0; namelist[i] != NULL; i++)
+			free(namelist[i]);
+		free(namelist);
+	}
+	if (map != MAP_FAILED)
+		munmap(map, size);
+	close(fd);
+	return ret;
+}
+
+int dircache_save(const char *dir, unsigned long long key,
+	struct dirent **namelist, int count)
+{
+	struct dircache_hdr *hdr;
+	struct dircache_ent *ents;
+	char fname[512], tmpname[520];
+	char *buf, *names;
+	size_t size, names_size = 0, path_len = strlen(dir);
+	struct stat st;
+	FILE *f;
+	int i, ret = -1;
+
+	if (count < 0 || stat(dir, &st) != 0)
+		return -1;
+	// FAT has 2s mtime resolution, a change right after this
+	// might not be visible, so don't trust recently modified dirs
+	if (time(NULL) - st.st_mtime < 3)
+		return -1;
+	if (dircache_fname(fname, sizeof(fname), dir, key) != 0)
+		return -1;
+
+	for (i = 0; i < count; i++)
+		names_size += strlen(namelist[i]->d_name) + 1;
+	names_size++; // never empty, simplifies checking
+
+	size = sizeof(*hdr) + count * sizeof(*ents) + path_len + 1 + names_size;
+	buf = calloc(1, size);
+	if (buf == NULL)
+		return -1;
+
+	hdr = (void *)buf;
+	memcpy(hdr->magic, DIRCACHE_MAGIC, 4);
+	hdr->version = DIRCACHE_VERSION;
+	hdr->key = key;
+	dircache_fill_stat(hdr, &st);
+	hdr->count = count;
+	hdr->path_len = path_len;
+	hdr->names_size = names_size;
+
+	ents = (void *)(hdr + 1);
+	memcpy(ents + count, dir, path_len + 1);
+	names = (char *)(ents + count) + path_len + 1;
+	names_size = 0;
+	for (i = 0; i < count; i++) {
+		size_t len = strlen(namelist[i]->d_name) + 1;
+		ents[i].name_ofs = names_size;
+		ents[i].type = namelist[i]->d_type;
+		memcpy(names + names_size, namelist[i]->d_name, len);
+		names_size += len;
+	}
+
+	// write and rename, so a reader never sees a partial file
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp", fname);
+	f = fopen(tmpname, "wb");
+	if (f == NULL)
+		goto out;
+	if (fwrite(buf, 1, size, f) != size) {
+		fclose(f);
+		remove(tmpname);
+		goto out;
+	}
+	fclose(f);
+	if (rename(tmpname, fname) != 0) {
+		remove(tmpname);
+		goto out;
+	}
+	ret = 0;
+
+out:
+	free(buf);
+	return ret;
+}
@@ -0,0 +1,18 @@
+#ifndef LIBPICOFE_DIRCACHE_H
+#define LIBPICOFE_DIRCACHE_H
+
+#include <dirent.h>
+
+/* On-disk cache of final (filtered, type resolved) directory listings,
+ * kept under plat_get_root_dir()/dircache/. A cache entry is valid while
+ * the directory's inode and mtime are unchanged; 'key' identifies the
+ * filter settings the listing was made with. */
+
+/* returns entry count with *namelist malloc'd like scandir's,
+ * or -1 if there is no valid cache */
+int dircache_load(const char *dir, unsigned long long key,
+		struct dirent ***namelist);
+int dircache_save(const char *dir, unsigned long long key,
+		struct dirent **namelist, int count);
+
+#endif // LIBPICOFE_DIRCACHE_H
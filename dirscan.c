@@ -0,0 +1,225 @@
+/*
+ * background directory reader
+ *
+ * This work is licensed under the terms of any of these licenses
+ * (at your option):
+ *  - GNU GPL, version 2 or later.
+ *  - GNU LGPL, version 2.1 or later.
+ *  - MAME license.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "plat.h"
+#include "dirscan.h"
+
+#define DIRSCAN_BATCH 64
+#define DIRSCAN_FLUSH_MS 50	// hand over at least this often on slow media
+
+struct dirscan {
+	DIR *dir;
+	char path[256];
+	int (*filter)(const struct dirent *);
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	int stop;
+	int done;
+	int error;	/* some entries were lost, the list is incomplete */
+	struct dirent **pending;
+	int pending_count;
+	int pending_alloc;
+};
+
+static struct dirent *dirscan_copy(const struct dirent *ent)
+{
+	// like glibc scandir, only allocate up to the end of the name
+	size_t size = offsetof(struct dirent, d_name) + strlen(ent->d_name) + 1;
+	struct dirent *d = malloc(size);
+
+	if (d != NULL)
+		memcpy(d, ent, size);
+	return d;
+}
+
+static void dirscan_resolve(struct dirscan *ds, struct dirent *d)
+{
+	char buf[512];
+	struct stat st;
+	int l = strlen(ds->path);
+
+	snprintf(buf, sizeof(buf), "%s%s%s", ds->path,
+		(l && ds->path[l - 1] == '/') ? "" : "/", d->d_name);
+	if (stat(buf, &st) != 0)
+		return;
+
+	if (S_ISREG(st.st_mode))
+		d->d_type = DT_REG;
+	else if (S_ISDIR(st.st_mode))
+		d->d_type = DT_DIR;
+}
+
+/* hand over the batch, returns nonzero if asked to stop */
+static int dirscan_flush(struct dirscan *ds, struct dirent **batch, int *count)
+{
+	struct dirent **tmp;
+	int i, stop;
+
+	pthread_mutex_lock(&ds->mutex);
+	stop = ds->stop;
+	if (*count == 0 || stop) {
+		pthread_mutex_unlock(&ds->mutex);
+		for (i = 0; i < *count; i++)
+			free(batch[i]);
+		*count = 0;
+		return stop;
+	}
+
+	if (ds->pending_count + *count > ds->pending_alloc) {
+		int alloc = ds->pending_alloc * 2 + *count;
+		tmp = realloc(ds->pending, alloc * sizeof(tmp[0]));
+		if (tmp == NULL) {
+			ds->error = 1;
+			pthread_mutex_unlock(&ds->mutex);
+			fprintf(stderr, "dirscan: OOM\n");
+			for (i = 0; i < *count; i++)
+				free(batch[i]);
+			*count = 0;
+			return 0;
+		}
+		ds->pending = tmp;
+		ds->pending_alloc = alloc;
+	}
+	memcpy(ds->pending + ds->pending_count, batch, *count * sizeof(batch[0]));
+	ds->pending_count += *count;
+	pthread_mutex_unlock(&ds->mutex);
+
+	*count = 0;
+	return 0;
+}
+
+static void *dirscan_thread(void *arg)
+{
+	struct dirscan *ds = arg;
+	struct dirent *batch[DIRSCAN_BATCH];
+	struct dirent *ent, *d;
+	unsigned int last = plat_get_ticks_ms();
+	int count = 0, stop = 0, error = 0;
+
+	while (!stop) {
+		errno = 0;
+		ent = readdir(ds->dir);
+		if (ent == NULL) {
+			if (errno != 0) {
+				perror("dirscan: readdir");
+				error = 1;
+			}
+			break;
+		}
+		if (ds->filter != NULL && !ds->filter(ent))
+			continue;
+
+		d = dirscan_copy(ent);
+		if (d == NULL) {
+			fprintf(stderr, "dirscan: OOM\n");
+			error = 1;
+			break;
+		}
+		if (d->d_type == DT_LNK || d->d_type == DT_UNKNOWN)
+			dirscan_resolve(ds, d);
+
+		batch[count++] = d;
+		if (count == DIRSCAN_BATCH
+		    || plat_get_ticks_ms() - last >= DIRSCAN_FLUSH_MS) {
+			stop = dirscan_flush(ds, batch, &count);
+			last = plat_get_ticks_ms();
+		}
+	}
+	dirscan_flush(ds, batch, &count);
+
+	pthread_mutex_lock(&ds->mutex);
+	ds->error |= error;
+	ds->done = 1;
+	pthread_mutex_unlock(&ds->mutex);
+
+	return NULL;
+}
+
+struct dirscan *dirscan_start(const char *path,
+	int (*filter)(const struct dirent *))
+{
+	struct dirscan *ds;
+
+	ds = calloc(1, sizeof(*ds));
+	if (ds == NULL)
+		return NULL;
+
+	ds->dir = opendir(path);
+	if (ds->dir == NULL) {
+		free(ds);
+		return NULL;
+	}
+	snprintf(ds->path, sizeof(ds->path), "%s", path);
+	ds->filter = filter;
+	pthread_mutex_init(&ds->mutex, NULL);
+
+	if (pthread_create(&ds->thread, NULL, dirscan_thread, ds) != 0) {
+		// no thread, read it all right here
+		dirscan_thread(ds);
+		ds->thread = pthread_self();
+	}
+
+	return ds;
+}
+
+int dirscan_collect(struct dirscan *ds, struct dirent ***list, int count,
+	int *done)
+{
+	struct dirent **tmp;
+
+	pthread_mutex_lock(&ds->mutex);
+	if (ds->pending_count > 0) {
+		tmp = realloc(*list, (count + ds->pending_count) * sizeof(tmp[0]));
+		if (tmp != NULL) {
+			memcpy(tmp + count, ds->pending,
+				ds->pending_count * sizeof(tmp[0]));
+			count += ds->pending_count;
+			ds->pending_count = 0;
+			*list = tmp;
+		}
+	}
+	*done = 0;
+	if (ds->done && ds->pending_count == 0)
+		*done = ds->error ? -1 : 1;
+	pthread_mutex_unlock(&ds->mutex);
+
+	return count;
+}
+
+void dirscan_finish(struct dirscan *ds)
+{
+	int i;
+
+	if (ds == NULL)
+		return;
+
+	pthread_mutex_lock(&ds->mutex);
+	ds->stop = 1;
+	pthread_mutex_unlock(&ds->mutex);
+	if (!pthread_equal(ds->thread, pthread_self()))
+		pthread_join(ds->thread, NULL);
+
+	closedir(ds->dir);
+	for (i = 0; i < ds->pending_count; i++)
+		free(ds->pending[i]);
+	free(ds->pending);
+	pthread_mutex_destroy(&ds->mutex);
+	free(ds);
+}
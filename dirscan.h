@@ -0,0 +1,25 @@
+#ifndef LIBPICOFE_DIRSCAN_H
+#define LIBPICOFE_DIRSCAN_H
+
+#include <dirent.h>
+
+struct dirscan;
+
+/* Reads a directory in a background thread, like scandir() without the
+ * sorting. DT_LNK/DT_UNKNOWN entries are resolved with stat() after
+ * filter() accepted them. Entries are handed over in batches.
+ * Returns NULL if the directory can't be opened. */
+struct dirscan *dirscan_start(const char *path,
+		int (*filter)(const struct dirent *));
+
+/* Appends entries found since the last call to *list (realloc'd,
+ * entries are malloc'd like scandir's), returns the new count.
+ * *done is set to 1 once everything was handed over, or to -1 if
+ * some entries were lost to an error and the list is incomplete. */
+int  dirscan_collect(struct dirscan *ds, struct dirent ***list, int count,
+		int *done);
+
+/* stops the thread if still running, drops anything not collected */
+void dirscan_finish(struct dirscan *ds);
+
+#endif // LIBPICOFE_DIRSCAN_H
@@ -0,0 +1,389 @@
+/*
+ * fill/copy helpers for write-combined framebuffer memory
+ *
+ * This work is licensed under the terms of any of these licenses
+ * (at your option):
+ *  - GNU GPL, version 2 or later.
+ *  - GNU LGPL, version 2.1 or later.
+ *  - MAME license.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+#include "fastmem.h"
+
+/* fill 'count' 32bit words, dst must be 4 byte aligned */
+static void fill32_aligned(uint32_t *dst, uint32_t val, size_t count)
+{
+	// get to 16 byte alignment with scalar stores
+	for (; count > 0 && ((uintptr_t)dst & 15); count--)
+		*dst++ = val;
+
+#if defined(HAVE_NEON)
+	{
+		uint32x4_t v = vdupq_n_u32(val);
+		// 64 bytes per iteration, fills a whole WC buffer at once
+		for (; count >= 16; count -= 16, dst += 16) {
+			vst1q_u32(dst + 0, v);
+			vst1q_u32(dst + 4, v);
+			vst1q_u32(dst + 8, v);
+			vst1q_u32(dst + 12, v);
+		}
+		for (; count >= 4; count -= 4, dst += 4)
+			vst1q_u32(dst, v);
+	}
+#elif defined(HAVE_SSE2)
+	{
+		__m128i v = _mm_set1_epi32(val);
+		for (; count >= 16; count -= 16, dst += 16) {
+			_mm_stream_si128((__m128i *)dst + 0, v);
+			_mm_stream_si128((__m128i *)dst + 1, v);
+			_mm_stream_si128((__m128i *)dst + 2, v);
+			_mm_stream_si128((__m128i *)dst + 3, v);
+		}
+		for (; count >= 4; count -= 4, dst += 4)
+			_mm_stream_si128((__m128i *)dst, v);
+		_mm_sfence();
+	}
+#else
+	for (; count >= 4; count -= 4, dst += 4)
+		dst[0] = dst[1] = dst[2] = dst[3] = val;
+#endif
+
+	for (; count > 0; count--)
+		*dst++ = val;
+}
+
+void fastmem_fill32(void *dst, unsigned int val, size_t count)
+{
+	if (((uintptr_t)dst & 3) == 0) {
+		fill32_aligned(dst, val, count);
+		return;
+	}
+
+	// unaligned, should not happen for framebuffers
+	{
+		unsigned char *d = dst;
+		for (; count > 0; count--, d += 4)
+			memcpy(d, &val, 4);
+	}
+}
+
+void fastmem_fill16(void *dst, unsigned short val, size_t count)
+{
+	unsigned short *d = dst;
+
+	if (count > 0 && ((uintptr_t)d & 2)) {
+		*d++ = val;
+		count--;
+	}
+
+	// 2 pixels per word, ordering doesn't matter as both halves are the same
+	fill32_aligned((uint32_t *)d, val | ((uint32_t)val << 16), count / 2);
+	if (count & 1)
+		d[count - 1] = val;
+}
+
+void fastmem_fill16_lines(void *dst, unsigned short val, int w, int lines, int pitch)
+{
+	char *d = dst;
+
+	// contiguous lines, do them in one go
+	if (pitch == w * 2) {
+		fastmem_fill16(d, val, (size_t)w * lines);
+		return;
+	}
+
+	for (; lines > 0; lines--, d += pitch)
+		fastmem_fill16(d, val, w);
+}
+
+void fastmem_copy(void *dst, const void *src, size_t bytes)
+{
+	unsigned char *d = dst;
+	const unsigned char *s = src;
+
+#if defined(HAVE_NEON) || defined(HAVE_SSE2)
+	// align dst, src alignment is up to luck (it's in cached memory anyway)
+	for (; bytes > 0 && ((uintptr_t)d & 15); bytes--)
+		*d++ = *s++;
+
+#if defined(HAVE_NEON)
+	for (; bytes >= 64; bytes -= 64, d += 64, s += 64) {
+		uint8x16_t v0 = vld1q_u8(s + 0);
+		uint8x16_t v1 = vld1q_u8(s + 16);
+		uint8x16_t v2 = vld1q_u8(s + 32);
+		uint8x16_t v3 = vld1q_u8(s + 48);
+		vst1q_u8(d + 0, v0);
+		vst1q_u8(d + 16, v1);
+		vst1q_u8(d + 32, v2);
+		vst1q_u8(d + 48, v3);
+	}
+#else
+	for (; bytes >= 64; bytes -= 64, d += 64, s += 64) {
+		__m128i v0 = _mm_loadu_si128((const __m128i *)s + 0);
+		__m128i v1 = _mm_loadu_si128((const __m128i *)s + 1);
+		__m128i v2 = _mm_loadu_si128((const __m128i *)s + 2);
+		__m128i v3 = _mm_loadu_si128((const __m128i *)s + 3);
+		_mm_stream_si128((__m128i *)d + 0, v0);
+		_mm_stream_si128((__m128i *)d + 1, v1);
+		_mm_stream_si128((__m128i *)d + 2, v2);
+		_mm_stream_si128((__m128i *)d + 3, v3);
+	}
+	_mm_sfence();
+#endif
+#endif
+
+	if (bytes > 0)
+		memcpy(d, s, bytes);
+}
+
+/* 4 lane xxhash32-like, lanes are independent so it vectorizes */
+#define HPRIME1 0x9e3779b1u
+#define HPRIME2 0x85ebca77u
+#define HPRIME3 0xc2b2ae3du
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+static uint32_t hash_avalanche(uint32_t h)
+{
+	h ^= h >> 15;
+	h *= HPRIME2;
+	h ^= h >> 13;
+	h *= HPRIME3;
+	h ^= h >> 16;
+	return h;
+}
+
+unsigned long long fastmem_hash(const void *src, size_t bytes)
+{
+	const unsigned char *s = src;
+	uint32_t a[4] = { HPRIME1, HPRIME2, HPRIME3, HPRIME1 + HPRIME2 };
+	uint32_t h0, h1, w;
+	size_t left = bytes;
+	int i;
+
+#if defined(HAVE_NEON)
+	{
+		uint32x4_t acc = vld1q_u32(a);
+		uint32x4_t p1 = vdupq_n_u32(HPRIME1);
+		uint32x4_t p2 = vdupq_n_u32(HPRIME2);
+		for (; left >= 16; left -= 16, s += 16) {
+			uint32x4_t v = vreinterpretq_u32_u8(vld1q_u8(s));
+			acc = vmlaq_u32(acc, v, p2);
+			acc = vsriq_n_u32(vshlq_n_u32(acc, 13), acc, 19);
+			acc = vmulq_u32(acc, p1);
+		}
+		vst1q_u32(a, acc);
+	}
+#else
+	for (; left >= 16; left -= 16, s += 16) {
+		for (i = 0; i < 4; i++) {
+			memcpy(&w, s + i * 4, 4);
+			a[i] += w * HPRIME2;
+			a[i] = ROTL32(a[i], 13) * HPRIME1;
+		}
+	}
+#endif
+
+	for (i = 0; left >= 4; left -= 4, s += 4, i = (i + 1) & 3) {
+		memcpy(&w, s, 4);
+		a[i] += w * HPRIME2;
+		a[i] = ROTL32(a[i], 13) * HPRIME1;
+	}
+	for (; left > 0; left--, s++) {
+		a[0] += *s * HPRIME1;
+		a[0] = ROTL32(a[0], 11) * HPRIME2;
+	}
+
+	h0 = ROTL32(a[0], 1) + ROTL32(a[1], 7) + (uint32_t)bytes;
+	h1 = ROTL32(a[2], 12) + ROTL32(a[3], 18) + (uint32_t)bytes;
+	h0 = hash_avalanche(h0 ^ a[2]);
+	h1 = hash_avalanche(h1 ^ a[0]);
+
+	return ((unsigned long long)h0 << 32) | h1;
+}
+
+/* RGB565 darkening: halve each channel (masks drop the bits that would
+ * shift into the next channel), 'darker' also subtracts 1/8 */
+#define DARKEN_HALF 0xf79e
+#define DARKEN_8TH  0xc618
+
+static uint16_t darken1(uint16_t p, int darker)
+{
+	uint16_t r = (p & DARKEN_HALF) >> 1;
+	if (darker)
+		r -= (p & DARKEN_8TH) >> 3;
+	return r;
+}
+
+void fastmem_darken16(void *dst, const void *src, size_t count, int darker)
+{
+	uint16_t *d = dst;
+	const uint16_t *s = src;
+
+#if defined(HAVE_NEON)
+	{
+		uint16x8_t half = vdupq_n_u16(DARKEN_HALF);
+		uint16x8_t m8 = vdupq_n_u16(darker ? DARKEN_8TH : 0);
+		for (; count >= 16; count -= 16, d += 16, s += 16) {
+			uint16x8_t p0 = vld1q_u16(s), p1 = vld1q_u16(s + 8);
+			vst1q_u16(d, vsubq_u16(vshrq_n_u16(vandq_u16(p0, half), 1),
+				vshrq_n_u16(vandq_u16(p0, m8), 3)));
+			vst1q_u16(d + 8, vsubq_u16(vshrq_n_u16(vandq_u16(p1, half), 1),
+				vshrq_n_u16(vandq_u16(p1, m8), 3)));
+		}
+	}
+#elif defined(HAVE_SSE2)
+	{
+		__m128i half = _mm_set1_epi16((short)DARKEN_HALF);
+		__m128i m8 = _mm_set1_epi16(darker ? (short)DARKEN_8TH : 0);
+		for (; count >= 16; count -= 16, d += 16, s += 16) {
+			__m128i p0 = _mm_loadu_si128((const __m128i *)s);
+			__m128i p1 = _mm_loadu_si128((const __m128i *)s + 1);
+			p0 = _mm_sub_epi16(_mm_srli_epi16(_mm_and_si128(p0, half), 1),
+				_mm_srli_epi16(_mm_and_si128(p0, m8), 3));
+			p1 = _mm_sub_epi16(_mm_srli_epi16(_mm_and_si128(p1, half), 1),
+				_mm_srli_epi16(_mm_and_si128(p1, m8), 3));
+			_mm_storeu_si128((__m128i *)d, p0);
+			_mm_storeu_si128((__m128i *)d + 1, p1);
+		}
+	}
+#endif
+
+	for (; count > 0; count--)
+		*d++ = darken1(*s++, darker);
+}
+
+void fastmem_darken16_except(void *dst, size_t count, unsigned short keep)
+{
+	uint16_t *d = dst;
+
+#if defined(HAVE_NEON)
+	{
+		uint16x8_t half = vdupq_n_u16(DARKEN_HALF);
+		uint16x8_t m8 = vdupq_n_u16(DARKEN_8TH);
+		uint16x8_t k = vdupq_n_u16(keep);
+		for (; count >= 8; count -= 8, d += 8) {
+			uint16x8_t p = vld1q_u16(d);
+			uint16x8_t r = vsubq_u16(vshrq_n_u16(vandq_u16(p, half), 1),
+				vshrq_n_u16(vandq_u16(p, m8), 3));
+			vst1q_u16(d, vbslq_u16(vceqq_u16(p, k), p, r));
+		}
+	}
+#elif defined(HAVE_SSE2)
+	{
+		__m128i half = _mm_set1_epi16((short)DARKEN_HALF);
+		__m128i m8 = _mm_set1_epi16((short)DARKEN_8TH);
+		__m128i k = _mm_set1_epi16((short)keep);
+		for (; count >= 8; count -= 8, d += 8) {
+			__m128i p = _mm_loadu_si128((const __m128i *)d);
+			__m128i r = _mm_sub_epi16(_mm_srli_epi16(_mm_and_si128(p, half), 1),
+				_mm_srli_epi16(_mm_and_si128(p, m8), 3));
+			__m128i eq = _mm_cmpeq_epi16(p, k);
+			r = _mm_or_si128(_mm_and_si128(eq, p), _mm_andnot_si128(eq, r));
+			_mm_storeu_si128((__m128i *)d, r);
+		}
+	}
+#endif
+
+	for (; count > 0; count--, d++)
+		if (*d != keep)
+			*d = darken1(*d, 1);
+}
+
+/* same for XRGB8888, X ends up 0 */
+#define DARKEN32_HALF 0x7f7f7f
+#define DARKEN32_8TH  0x1f1f1f
+
+static uint32_t darken1_32(uint32_t p, int darker)
+{
+	uint32_t r = (p >> 1) & DARKEN32_HALF;
+	if (darker)
+		r -= (p >> 3) & DARKEN32_8TH;
+	return r;
+}
+
+void fastmem_darken32(void *dst, const void *src, size_t count, int darker)
+{
+	uint32_t *d = dst;
+	const uint32_t *s = src;
+
+#if defined(HAVE_NEON)
+	{
+		uint32x4_t half = vdupq_n_u32(DARKEN32_HALF);
+		uint32x4_t m8 = vdupq_n_u32(darker ? DARKEN32_8TH : 0);
+		for (; count >= 8; count -= 8, d += 8, s += 8) {
+			uint32x4_t p0 = vld1q_u32(s), p1 = vld1q_u32(s + 4);
+			vst1q_u32(d, vsubq_u32(vandq_u32(vshrq_n_u32(p0, 1), half),
+				vandq_u32(vshrq_n_u32(p0, 3), m8)));
+			vst1q_u32(d + 4, vsubq_u32(vandq_u32(vshrq_n_u32(p1, 1), half),
+				vandq_u32(vshrq_n_u32(p1, 3), m8)));
+		}
+	}
+#elif defined(HAVE_SSE2)
+	{
+		__m128i half = _mm_set1_epi32(DARKEN32_HALF);
+		__m128i m8 = _mm_set1_epi32(darker ? DARKEN32_8TH : 0);
+		for (; count >= 8; count -= 8, d += 8, s += 8) {
+			__m128i p0 = _mm_loadu_si128((const __m128i *)s);
+			__m128i p1 = _mm_loadu_si128((const __m128i *)s + 1);
+			p0 = _mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(p0, 1), half),
+				_mm_and_si128(_mm_srli_epi32(p0, 3), m8));
+			p1 = _mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(p1, 1), half),
+				_mm_and_si128(_mm_srli_epi32(p1, 3), m8));
+			_mm_storeu_si128((__m128i *)d, p0);
+			_mm_storeu_si128((__m128i *)d + 1, p1);
+		}
+	}
+#endif
+
+	for (; count > 0; count--)
+		*d++ = darken1_32(*s++, darker);
+}
+
+void fastmem_darken32_except(void *dst, size_t count, unsigned int keep)
+{
+	uint32_t *d = dst;
+
+#if defined(HAVE_NEON)
+	{
+		uint32x4_t half = vdupq_n_u32(DARKEN32_HALF);
+		uint32x4_t m8 = vdupq_n_u32(DARKEN32_8TH);
+		uint32x4_t k = vdupq_n_u32(keep);
+		for (; count >= 4; count -= 4, d += 4) {
+			uint32x4_t p = vld1q_u32(d);
+			uint32x4_t r = vsubq_u32(vandq_u32(vshrq_n_u32(p, 1), half),
+				vandq_u32(vshrq_n_u32(p, 3), m8));
+			vst1q_u32(d, vbslq_u32(vceqq_u32(p, k), p, r));
+		}
+	}
+#elif defined(HAVE_SSE2)
+	{
+		__m128i half = _mm_set1_epi32(DARKEN32_HALF);
+		__m128i m8 = _mm_set1_epi32(DARKEN32_8TH);
+		__m128i k = _mm_set1_epi32((int)keep);
+		for (; count >= 4; count -= 4, d += 4) {
+			__m128i p = _mm_loadu_si128((const __m128i *)d);
+			__m128i r = _mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(p, 1), half),
+				_mm_and_si128(_mm_srli_epi32(p, 3), m8));
+			__m128i eq = _mm_cmpeq_epi32(p, k);
+			r = _mm_or_si128(_mm_and_si128(eq, p), _mm_andnot_si128(eq, r));
+			_mm_storeu_si128((__m128i *)d, r);
+		}
+	}
+#endif
+
+	for (; count > 0; count--, d++)
+		if (*d != keep)
+			*d = darken1_32(*d, 1);
+}
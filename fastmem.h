@@ -0,0 +1,44 @@
+#ifndef LIBPICOFE_FASTMEM_H
+#define LIBPICOFE_FASTMEM_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* fill/copy for write-combined or uncached memory (framebuffers,
+ * overlays). Stores are done in wide aligned bursts, non-temporal
+ * where the CPU has them, so they don't pollute the cache. */
+void fastmem_fill16(void *dst, unsigned short val, size_t count);
+void fastmem_fill32(void *dst, unsigned int val, size_t count);
+void fastmem_copy(void *dst, const void *src, size_t bytes);
+
+/* fast non-cryptographic hash, for detecting changed lines */
+unsigned long long fastmem_hash(const void *src, size_t bytes);
+
+/* RGB565/XRGB8888 darken to 1/2 brightness, or about 3/8 if 'darker',
+ * dst may be src; the _except variant works in place and at 3/8,
+ * leaving pixels of color 'keep' (text) untouched */
+void fastmem_darken16(void *dst, const void *src, size_t count, int darker);
+void fastmem_darken16_except(void *dst, size_t count, unsigned short keep);
+void fastmem_darken32(void *dst, const void *src, size_t count, int darker);
+void fastmem_darken32_except(void *dst, size_t count, unsigned int keep);
+
+/* fill 'lines' lines of 'w' 16bpp pixels, pitch is in bytes */
+void fastmem_fill16_lines(void *dst, unsigned short val, int w, int lines, int pitch);
+
+static __inline void fastmem_clear(void *dst, size_t bytes)
+{
+	fastmem_fill32(dst, 0, bytes / 4);
+	if (bytes & 3)
+		fastmem_fill16((char *)dst + (bytes & ~3), 0, (bytes & 3) / 2);
+	if (bytes & 1)
+		((char *)dst)[bytes - 1] = 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIBPICOFE_FASTMEM_H
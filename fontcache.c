@@ -0,0 +1,703 @@
+/*
+ * glyph cache for TTF menu text
+ *
+ * This work is licensed under the terms of any of these licenses
+ * (at your option):
+ *  - GNU GPL, version 2 or later.
+ *  - GNU LGPL, version 2.1 or later.
+ *  - MAME license.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL/SDL.h>
+#include <SDL/SDL_ttf.h>
+
+#include "fastmem.h"
+#include "fontcache.h"
+
+#define FC_HASH_BITS 10
+#define FC_HASH_SIZE (1 << FC_HASH_BITS)
+
+#define FC_STRINGS 256
+#define FC_STRING_MAX_LEN 255
+#define FC_STRING_MAX_AGE 120	// frames
+
+#define FC_SAVE_VERSION 1
+
+struct fc_glyph {
+	unsigned int stamp;	// last use, for LRU
+	unsigned short ch;
+	short advance;
+	short w;		// mask width, trimmed
+	short next;		// hash chain
+	unsigned char y0, y1;	// non-empty rows
+};
+
+/* whole string, pre-composed alpha mask */
+struct fc_string {
+	unsigned long long hash;
+	char *text;		// NULL if slot is free
+	unsigned int frame;	// last use
+	int w;			// advance width
+	int mask_w;
+	short next;
+	unsigned char y0, y1;
+	unsigned char *mask;	// mask_w * line_h
+};
+
+struct fontcache {
+	TTF_Font *font;
+	char *font_path;	// opened on the first miss if font is NULL
+	int font_size;
+	int font_failed;
+	int rasterized;		// since creation or the last save
+	int line_h;
+	int cell_w;
+	int count;
+	int used;
+	unsigned int stamp;
+	struct fc_glyph *glyphs;
+	short hash[FC_HASH_SIZE];
+	unsigned char *atlas;	// count cells of cell_w * line_h alpha
+
+	unsigned int frame;
+	struct fc_string strings[FC_STRINGS];
+	short str_hash[FC_STRINGS];
+};
+
+static unsigned int fc_hash(unsigned int ch)
+{
+	return (ch * 2654435761u) >> (32 - FC_HASH_BITS);
+}
+
+static unsigned int utf8_next(const unsigned char **p)
+{
+	const unsigned char *s = *p;
+	unsigned int c = *s++;
+
+	if (c >= 0xf0 && (s[0] & 0xc0) == 0x80 && (s[1] & 0xc0) == 0x80
+	    && (s[2] & 0xc0) == 0x80) {
+		c = ((c & 0x07) << 18) | ((s[0] & 0x3f) << 12)
+			| ((s[1] & 0x3f) << 6) | (s[2] & 0x3f);
+		s += 3;
+	}
+	else if (c >= 0xe0 && (s[0] & 0xc0) == 0x80 && (s[1] & 0xc0) == 0x80) {
+		c = ((c & 0x0f) << 12) | ((s[0] & 0x3f) << 6) | (s[1] & 0x3f);
+		s += 2;
+	}
+	else if (c >= 0xc0 && (s[0] & 0xc0) == 0x80) {
+		c = ((c & 0x1f) << 6) | (s[0] & 0x3f);
+		s += 1;
+	}
+	else if (c >= 0x80)
+		c = '?'; // broken sequence
+
+	*p = s;
+	return c;
+}
+
+static int utf8_put(char *d, unsigned int c)
+{
+	if (c < 0x80) {
+		d[0] = c;
+		return 1;
+	}
+	if (c < 0x800) {
+		d[0] = 0xc0 | (c >> 6);
+		d[1] = 0x80 | (c & 0x3f);
+		return 2;
+	}
+	d[0] = 0xe0 | (c >> 12);
+	d[1] = 0x80 | ((c >> 6) & 0x3f);
+	d[2] = 0x80 | (c & 0x3f);
+	return 3;
+}
+
+static void fc_unlink(struct fontcache *fc, int idx)
+{
+	short *link = &fc->hash[fc_hash(fc->glyphs[idx].ch)];
+
+	while (*link >= 0) {
+		if (*link == idx) {
+			*link = fc->glyphs[idx].next;
+			return;
+		}
+		link = &fc->glyphs[*link].next;
+	}
+}
+
+static void fc_rasterize(struct fontcache *fc, int idx, unsigned int ch)
+{
+	struct fc_glyph *g = &fc->glyphs[idx];
+	unsigned char *cell = fc->atlas + idx * fc->cell_w * fc->line_h;
+	SDL_Color white = { 255, 255, 255 };
+	SDL_Surface *s;
+	char buf[4];
+	int x, y, w, h, advance;
+
+	memset(cell, 0, fc->cell_w * fc->line_h);
+	g->ch = ch;
+	g->w = 0;
+	g->advance = 0;
+	g->y0 = g->y1 = 0;
+
+	if (fc->font == NULL && fc->font_path != NULL && !fc->font_failed) {
+		fc->font = TTF_OpenFont(fc->font_path, fc->font_size);
+		if (fc->font == NULL) {
+			fprintf(stderr, "fontcache: can't open %s: %s\n",
+				fc->font_path, SDL_GetError());
+			fc->font_failed = 1;
+		}
+	}
+	if (fc->font == NULL)
+		return;
+	fc->rasterized++;
+
+	buf[utf8_put(buf, ch)] = 0;
+	s = TTF_RenderUTF8_Blended(fc->font, buf, white);
+	if (s != NULL) {
+		SDL_PixelFormat *fmt = s->format;
+
+		w = s->w < fc->cell_w ? s->w : fc->cell_w;
+		h = s->h < fc->line_h ? s->h : fc->line_h;
+		g->y0 = h;
+		SDL_LockSurface(s);
+		for (y = 0; y < h; y++) {
+			const Uint32 *src = (Uint32 *)((Uint8 *)s->pixels + y * s->pitch);
+			unsigned char *d = cell + y * fc->cell_w;
+			for (x = 0; x < w; x++) {
+				d[x] = (src[x] & fmt->Amask) >> fmt->Ashift;
+				if (d[x] == 0)
+					continue;
+				if (x + 1 > g->w)
+					g->w = x + 1;
+				if (y < g->y0)
+					g->y0 = y;
+				g->y1 = y + 1;
+			}
+		}
+		SDL_UnlockSurface(s);
+		if (g->y0 > g->y1)
+			g->y0 = g->y1;
+	}
+
+	if (TTF_GlyphMetrics(fc->font, ch, NULL, NULL, NULL, NULL, &advance) != 0)
+		advance = s != NULL ? s->w : 0;
+	g->advance = advance;
+
+	if (s != NULL)
+		SDL_FreeSurface(s);
+}
+
+static struct fc_glyph *fc_get(struct fontcache *fc, unsigned int ch)
+{
+	unsigned int bucket = fc_hash(ch);
+	int i, idx;
+
+	for (idx = fc->hash[bucket]; idx >= 0; idx = fc->glyphs[idx].next) {
+		if (fc->glyphs[idx].ch == ch) {
+			fc->glyphs[idx].stamp = fc->stamp;
+			return &fc->glyphs[idx];
+		}
+	}
+
+	// miss, take a free cell or the least recently used one
+	if (fc->used < fc->count)
+		idx = fc->used++;
+	else {
+		idx = 0;
+		for (i = 1; i < fc->count; i++)
+			if ((int)(fc->glyphs[i].stamp - fc->glyphs[idx].stamp) < 0)
+				idx = i;
+		fc_unlink(fc, idx);
+	}
+
+	fc_rasterize(fc, idx, ch);
+	fc->glyphs[idx].stamp = fc->stamp;
+	fc->glyphs[idx].next = fc->hash[bucket];
+	fc->hash[bucket] = idx;
+
+	return &fc->glyphs[idx];
+}
+
+static void blend_mask16(unsigned short *d, const unsigned char *m, int w,
+	unsigned short color)
+{
+	unsigned int c32 = (color | ((unsigned int)color << 16)) & 0x07e0f81f;
+	unsigned int bg;
+	int i, a;
+
+	for (i = 0; i < w; i++) {
+		a = m[i];
+		if (a < 8)
+			continue;
+		if (a >= 0xf8) {
+			d[i] = color;
+			continue;
+		}
+		// r/b and g spread apart so one multiply blends all three
+		a = (a + 4) >> 3;
+		bg = (d[i] | ((unsigned int)d[i] << 16)) & 0x07e0f81f;
+		bg = ((((c32 - bg) * a) >> 5) + bg) & 0x07e0f81f;
+		d[i] = bg | (bg >> 16);
+	}
+}
+
+static void blend_mask32(unsigned int *d, const unsigned char *m, int w,
+	unsigned int color)
+{
+	unsigned int c_rb = color & 0xff00ff, c_g = color & 0x00ff00;
+	unsigned int rb, g;
+	int i, a;
+
+	for (i = 0; i < w; i++) {
+		a = m[i];
+		if (a < 8)
+			continue;
+		if (a >= 0xf8) {
+			d[i] = color;
+			continue;
+		}
+		rb = d[i] & 0xff00ff;
+		g = d[i] & 0x00ff00;
+		rb = ((c_rb * a + rb * (256 - a)) >> 8) & 0xff00ff;
+		g = ((c_g * a + g * (256 - a)) >> 8) & 0x00ff00;
+		d[i] = rb | g;
+	}
+}
+
+static void blend_mask(void *d, int x, const unsigned char *m, int w,
+	unsigned int color, int bpp)
+{
+	if (bpp == 32)
+		blend_mask32((unsigned int *)d + x, m, w, color);
+	else
+		blend_mask16((unsigned short *)d + x, m, w, color);
+}
+
+static struct fc_glyph *fc_next_glyph(struct fontcache *fc, const unsigned char **p)
+{
+	unsigned int ch;
+
+	while (**p != 0) {
+		ch = utf8_next(p);
+		if (ch < 0x20)
+			continue;
+		if (ch > 0xffff)
+			ch = '?'; // SDL_ttf glyph API is UCS-2 only
+		return fc_get(fc, ch);
+	}
+
+	return NULL;
+}
+
+/* glyph by glyph, for strings too long to be cached */
+static int fc_draw_direct(struct fontcache *fc, void *dst, int dst_w, int dst_h,
+	int pitch, int x, int y, unsigned int color, const char *text, int bpp)
+{
+	const unsigned char *p = (const unsigned char *)text;
+	struct fc_glyph *g;
+	int pen = x, sx, w, row, y0, y1;
+
+	fc->stamp++;
+	while ((g = fc_next_glyph(fc, &p)) != NULL) {
+		// clip like fc_draw() does
+		sx = pen < 0 ? -pen : 0;
+		w = g->w;
+		if (pen + w > dst_w)
+			w = dst_w - pen;
+		w -= sx;
+		y0 = y + g->y0;
+		y1 = y + g->y1;
+		if (y1 > dst_h)
+			y1 = dst_h;
+
+		if (w > 0 && dst != NULL) {
+			const unsigned char *m = fc->atlas
+				+ (g - fc->glyphs) * fc->cell_w * fc->line_h
+				+ g->y0 * fc->cell_w + sx;
+			for (row = y0; row < y1; row++, m += fc->cell_w) {
+				if (row < 0)
+					continue;
+				blend_mask((char *)dst + row * pitch, pen + sx, m, w, color, bpp);
+			}
+		}
+		pen += g->advance;
+	}
+
+	return pen - x;
+}
+
+static void fc_render_string(struct fontcache *fc, struct fc_string *e)
+{
+	const unsigned char *p = (const unsigned char *)e->text;
+	struct fc_glyph *g;
+	int pen = 0, ext = 0, x, y;
+
+	e->w = e->mask_w = 0;
+	e->y0 = e->y1 = 0;
+	e->mask = NULL;
+
+	fc->stamp++;
+	while ((g = fc_next_glyph(fc, &p)) != NULL) {
+		if (pen + g->w > ext)
+			ext = pen + g->w;
+		pen += g->advance;
+	}
+	e->w = pen;
+	if (ext == 0)
+		return;
+
+	e->mask = calloc(ext, fc->line_h);
+	if (e->mask == NULL)
+		return;
+	e->mask_w = ext;
+	e->y0 = fc->line_h;
+
+	pen = 0;
+	p = (const unsigned char *)e->text;
+	while ((g = fc_next_glyph(fc, &p)) != NULL) {
+		const unsigned char *m = fc->atlas
+			+ (g - fc->glyphs) * fc->cell_w * fc->line_h;
+		for (y = g->y0; y < g->y1; y++) {
+			const unsigned char *s = m + y * fc->cell_w;
+			unsigned char *d = e->mask + y * ext + pen;
+			// glyphs may overlap a bit
+			for (x = 0; x < g->w; x++)
+				if (s[x] > d[x])
+					d[x] = s[x];
+		}
+		if (g->y1 > g->y0) {
+			if (g->y0 < e->y0)
+				e->y0 = g->y0;
+			if (g->y1 > e->y1)
+				e->y1 = g->y1;
+		}
+		pen += g->advance;
+	}
+	if (e->y0 > e->y1)
+		e->y0 = e->y1;
+}
+
+static void fc_string_drop(struct fontcache *fc, int idx)
+{
+	struct fc_string *e = &fc->strings[idx];
+	short *link = &fc->str_hash[e->hash % FC_STRINGS];
+
+	while (*link >= 0) {
+		if (*link == idx) {
+			*link = e->next;
+			break;
+		}
+		link = &fc->strings[*link].next;
+	}
+	free(e->text);
+	free(e->mask);
+	e->text = NULL;
+	e->mask = NULL;
+}
+
+static struct fc_string *fc_string_get(struct fontcache *fc, const char *text)
+{
+	size_t len = strlen(text);
+	unsigned long long hash;
+	struct fc_string *e;
+	int i, idx;
+
+	if (len > FC_STRING_MAX_LEN)
+		return NULL;
+
+	hash = fastmem_hash(text, len);
+	for (idx = fc->str_hash[hash % FC_STRINGS]; idx >= 0; idx = e->next) {
+		e = &fc->strings[idx];
+		if (e->hash == hash && strcmp(e->text, text) == 0) {
+			e->frame = fc->frame;
+			return e;
+		}
+	}
+
+	// free slot, or else the one unused for longest
+	idx = 0;
+	for (i = 0; i < FC_STRINGS; i++) {
+		if (fc->strings[i].text == NULL) {
+			idx = i;
+			break;
+		}
+		if ((int)(fc->strings[i].frame - fc->strings[idx].frame) < 0)
+			idx = i;
+	}
+	if (fc->strings[idx].text != NULL)
+		fc_string_drop(fc, idx);
+
+	e = &fc->strings[idx];
+	e->text = malloc(len + 1);
+	if (e->text == NULL)
+		return NULL;
+	memcpy(e->text, text, len + 1);
+	e->hash = hash;
+	e->frame = fc->frame;
+	fc_render_string(fc, e);
+
+	e->next = fc->str_hash[hash % FC_STRINGS];
+	fc->str_hash[hash % FC_STRINGS] = idx;
+
+	return e;
+}
+
+static int fc_draw(struct fontcache *fc, void *dst, int dst_w, int dst_h,
+	int pitch, int x, int y, unsigned int color, const char *text, int *h, int bpp)
+{
+	struct fc_string *e;
+	const unsigned char *m;
+	int w, sx = 0, row, y0, y1;
+
+	if (h != NULL)
+		*h = 0;
+	if (fc == NULL || text == NULL)
+		return 0;
+
+	e = fc_string_get(fc, text);
+	if (e == NULL)
+		w = fc_draw_direct(fc, dst, dst_w, dst_h, pitch, x, y, color, text, bpp);
+	else {
+		w = e->mask_w;
+		if (x < 0)
+			sx = -x;
+		if (x + w > dst_w)
+			w = dst_w - x;
+		y0 = y + e->y0;
+		y1 = y + e->y1;
+		if (y0 < 0)
+			y0 = 0;
+		if (y1 > dst_h)
+			y1 = dst_h;
+
+		if (w > sx && e->mask != NULL) {
+			m = e->mask + (y0 - y) * e->mask_w + sx;
+			for (row = y0; row < y1; row++, m += e->mask_w)
+				blend_mask((char *)dst + row * pitch, x + sx, m, w - sx, color, bpp);
+		}
+		w = e->w;
+	}
+
+	if (w > 0 && h != NULL)
+		*h = fc->line_h;
+
+	return w;
+}
+
+int fontcache_draw16(struct fontcache *fc, void *dst, int dst_w, int dst_h,
+	int pitch, int x, int y, unsigned short color, const char *text, int *h)
+{
+	return fc_draw(fc, dst, dst_w, dst_h, pitch, x, y, color, text, h, 16);
+}
+
+int fontcache_draw32(struct fontcache *fc, void *dst, int dst_w, int dst_h,
+	int pitch, int x, int y, unsigned int color, const char *text, int *h)
+{
+	return fc_draw(fc, dst, dst_w, dst_h, pitch, x, y, color, text, h, 32);
+}
+
+int fontcache_text_width(struct fontcache *fc, const char *text)
+{
+	struct fc_string *e;
+
+	if (fc == NULL || text == NULL)
+		return 0;
+
+	e = fc_string_get(fc, text);
+	if (e != NULL)
+		return e->w;
+
+	return fc_draw_direct(fc, NULL, 0, 0, 0, 0, 0, 0, text, 16);
+}
+
+void fontcache_frame(struct fontcache *fc)
+{
+	int i;
+
+	if (fc == NULL)
+		return;
+
+	fc->frame++;
+	for (i = 0; i < FC_STRINGS; i++)
+		if (fc->strings[i].text != NULL
+		    && fc->frame - fc->strings[i].frame > FC_STRING_MAX_AGE)
+			fc_string_drop(fc, i);
+}
+
+static struct fontcache *fc_alloc(int line_h, int max_glyphs)
+{
+	struct fontcache *fc;
+
+	if (max_glyphs < 16)
+		max_glyphs = 16;
+	if (max_glyphs > 0x7fff)
+		max_glyphs = 0x7fff;
+
+	fc = calloc(1, sizeof(*fc));
+	if (fc == NULL)
+		goto oom;
+
+	fc->line_h = line_h;
+	if (fc->line_h > 255)
+		fc->line_h = 255;
+	// wide enough for CJK, anything wider gets clipped
+	fc->cell_w = fc->line_h + fc->line_h / 2;
+	fc->count = max_glyphs;
+	memset(fc->hash, 0xff, sizeof(fc->hash));
+	memset(fc->str_hash, 0xff, sizeof(fc->str_hash));
+
+	fc->glyphs = calloc(max_glyphs, sizeof(fc->glyphs[0]));
+	fc->atlas = malloc(max_glyphs * fc->cell_w * fc->line_h);
+	if (fc->glyphs == NULL || fc->atlas == NULL)
+		goto oom;
+
+	return fc;
+
+oom:
+	fprintf(stderr, "fontcache: OOM\n");
+	fontcache_free(fc);
+	return NULL;
+}
+
+struct fontcache *fontcache_new(TTF_Font *font, int max_glyphs)
+{
+	struct fontcache *fc;
+
+	if (font == NULL)
+		return NULL;
+
+	fc = fc_alloc(TTF_FontHeight(font), max_glyphs);
+	if (fc != NULL)
+		fc->font = font;
+	return fc;
+}
+
+int fontcache_rasterized(struct fontcache *fc)
+{
+	return fc != NULL ? fc->rasterized : 0;
+}
+
+/* saved form: header, glyph records, then their cells */
+struct fc_save_hdr {
+	unsigned int version;
+	int line_h;
+	int cell_w;
+	int count;
+};
+
+struct fc_save_glyph {
+	unsigned short ch;
+	short advance;
+	short w;
+	unsigned char y0, y1;
+};
+
+void *fontcache_save(struct fontcache *fc, size_t *size)
+{
+	struct fc_save_hdr *hdr;
+	struct fc_save_glyph *sg;
+	size_t cell = fc->cell_w * fc->line_h;
+	unsigned char *d;
+	int i;
+
+	*size = sizeof(*hdr) + fc->used * (sizeof(*sg) + cell);
+	hdr = malloc(*size);
+	if (hdr == NULL)
+		return NULL;
+
+	hdr->version = FC_SAVE_VERSION;
+	hdr->line_h = fc->line_h;
+	hdr->cell_w = fc->cell_w;
+	hdr->count = fc->used;
+	sg = (void *)(hdr + 1);
+	d = (unsigned char *)(sg + fc->used);
+	for (i = 0; i < fc->used; i++, d += cell) {
+		sg[i].ch = fc->glyphs[i].ch;
+		sg[i].advance = fc->glyphs[i].advance;
+		sg[i].w = fc->glyphs[i].w;
+		sg[i].y0 = fc->glyphs[i].y0;
+		sg[i].y1 = fc->glyphs[i].y1;
+		memcpy(d, fc->atlas + i * cell, cell);
+	}
+	fc->rasterized = 0;
+
+	return hdr;
+}
+
+struct fontcache *fontcache_load(const void *data, size_t size,
+	const char *font_path, int font_size, int max_glyphs)
+{
+	const struct fc_save_hdr *hdr = data;
+	const struct fc_save_glyph *sg;
+	const unsigned char *s;
+	struct fontcache *fc;
+	size_t cell;
+	int i;
+
+	if (size < sizeof(*hdr) || hdr->version != FC_SAVE_VERSION
+	    || hdr->line_h <= 0 || hdr->line_h > 255 || hdr->cell_w <= 0
+	    || hdr->count < 0 || hdr->count > 0x7fff)
+		return NULL;
+	cell = hdr->cell_w * hdr->line_h;
+	if (size != sizeof(*hdr) + hdr->count * (sizeof(*sg) + cell))
+		return NULL;
+
+	if (max_glyphs < hdr->count)
+		max_glyphs = hdr->count;
+	fc = fc_alloc(hdr->line_h, max_glyphs);
+	if (fc == NULL)
+		return NULL;
+	if (fc->cell_w != hdr->cell_w)
+		goto fail;
+	fc->font_path = strdup(font_path);
+	fc->font_size = font_size;
+	if (fc->font_path == NULL)
+		goto fail;
+
+	sg = (const void *)(hdr + 1);
+	s = (const unsigned char *)(sg + hdr->count);
+	for (i = 0; i < hdr->count; i++, s += cell) {
+		struct fc_glyph *g = &fc->glyphs[i];
+		unsigned int bucket = fc_hash(sg[i].ch);
+
+		g->ch = sg[i].ch;
+		g->advance = sg[i].advance;
+		g->w = sg[i].w < fc->cell_w ? sg[i].w : fc->cell_w;
+		g->y0 = sg[i].y0 < fc->line_h ? sg[i].y0 : fc->line_h;
+		g->y1 = sg[i].y1 < fc->line_h ? sg[i].y1 : fc->line_h;
+		memcpy(fc->atlas + i * cell, s, cell);
+		g->next = fc->hash[bucket];
+		fc->hash[bucket] = i;
+	}
+	fc->used = hdr->count;
+
+	return fc;
+
+fail:
+	fontcache_free(fc);
+	return NULL;
+}
+
+void fontcache_free(struct fontcache *fc)
+{
+	int i;
+
+	if (fc == NULL)
+		return;
+	// only a font we opened ourselves
+	if (fc->font_path != NULL && fc->font != NULL)
+		TTF_CloseFont(fc->font);
+	free(fc->font_path);
+	for (i = 0; i < FC_STRINGS; i++) {
+		free(fc->strings[i].text);
+		free(fc->strings[i].mask);
+	}
+	free(fc->glyphs);
+	free(fc->atlas);
+	free(fc);
+}
@@ -0,0 +1,35 @@
+#ifndef LIBPICOFE_FONTCACHE_H
+#define LIBPICOFE_FONTCACHE_H
+
+#include <SDL/SDL_ttf.h>
+
+struct fontcache;
+
+/* Per-font glyph atlas. Each code point is rasterized once into a
+ * fixed-size alpha cell, cells are recycled least recently used first.
+ * Text is then composed from the cached masks straight into 16bpp. */
+struct fontcache *fontcache_new(TTF_Font *font, int max_glyphs);
+void fontcache_free(struct fontcache *fc);
+
+/* returns text width, *h (optional) gets the line height or 0 if
+ * nothing was drawn. pitch is in bytes, draw32 is for XRGB8888.
+ * Whole strings are cached as composed masks too, so redrawing the same
+ * label is a single blend; fontcache_frame() should be called once per
+ * drawn frame to age out strings that are no longer shown. */
+int  fontcache_draw16(struct fontcache *fc, void *dst, int dst_w, int dst_h,
+		int pitch, int x, int y, unsigned short color, const char *text, int *h);
+int  fontcache_draw32(struct fontcache *fc, void *dst, int dst_w, int dst_h,
+		int pitch, int x, int y, unsigned int color, const char *text, int *h);
+int  fontcache_text_width(struct fontcache *fc, const char *text);
+void fontcache_frame(struct fontcache *fc);
+
+/* Rasterized glyphs as a malloc'd blob, and a cache made from one.
+ * A loaded cache opens font_path itself, only once it meets a glyph
+ * that wasn't saved. fontcache_rasterized() counts the glyphs added
+ * since creation or the last save. */
+void *fontcache_save(struct fontcache *fc, size_t *size);
+struct fontcache *fontcache_load(const void *data, size_t size,
+		const char *font_path, int font_size, int max_glyphs);
+int  fontcache_rasterized(struct fontcache *fc);
+
+#endif // LIBPICOFE_FONTCACHE_H
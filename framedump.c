@@ -0,0 +1,363 @@
+/*
+ * video frame dump stream
+ *
+ * This work is licensed under the terms of any of these licenses
+ * (at your option):
+ *  - GNU GPL, version 2 or later.
+ *  - GNU LGPL, version 2.1 or later.
+ *  - MAME license.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "plat.h"
+#include "fastmem.h"
+#include "framedump.h"
+
+#define FRAMEDUMP_QUEUE 4
+#define FRAMEDUMP_MAX_QUEUE 32
+
+struct fd_frame {
+	void *pixels;		// packed, pitch is w * bpp / 8
+	size_t alloc;
+	int w, h, bpp;
+	unsigned int num;
+};
+
+static struct {
+	int active;
+	int threaded;
+	int format;
+	int fps;
+	FILE *out;
+	FILE *idx;
+	unsigned long long offset;
+	unsigned int next_num;
+	int y4m_w, y4m_h;	// 0 until the header is written
+	unsigned char *yuv;
+
+	pthread_t thread;
+	int stop;
+	struct fd_frame frames[FRAMEDUMP_MAX_QUEUE];
+	int free_list[FRAMEDUMP_MAX_QUEUE];
+	int free_count;
+	int queue[FRAMEDUMP_MAX_QUEUE];
+	int q_head, q_len;
+	struct framedump_stats stats;
+} fd;
+
+static pthread_mutex_t fd_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fd_cond = PTHREAD_COND_INITIALIZER;
+
+static unsigned long long fd_hash(const void *buf, int w, int h, int bpp, int pitch)
+{
+	const char *p = buf;
+	unsigned long long hash = 0;
+	int y;
+
+	// same as plat_offscreen's, so the two can be compared
+	for (y = 0; y < h; y++, p += pitch)
+		hash = hash * 31 + fastmem_hash(p, w * bpp / 8);
+	return hash;
+}
+
+static void fd_rgb(const void *src, int i, int bpp, int *r, int *g, int *b)
+{
+	unsigned int p;
+
+	if (bpp == 32) {
+		p = ((const unsigned int *)src)[i];
+		*r = (p >> 16) & 0xff;
+		*g = (p >> 8) & 0xff;
+		*b = p & 0xff;
+		return;
+	}
+	p = ((const unsigned short *)src)[i];
+	*r = ((p >> 8) & 0xf8) | (p >> 13);
+	*g = ((p >> 3) & 0xfc) | ((p >> 9) & 3);
+	*b = ((p << 3) & 0xf8) | ((p >> 2) & 7);
+}
+
+/* BT.601 limited range, chroma averaged over 2x2 */
+static void fd_to_yuv420(unsigned char *yuv, const void *src, int w, int h, int bpp)
+{
+	int cw = (w + 1) / 2, ch = (h + 1) / 2;
+	unsigned char *py = yuv, *pu = yuv + w * h, *pv = pu + cw * ch;
+	int x, y, dx, dy, r, g, b, sr, sg, sb, n;
+
+	for (y = 0; y < h; y++)
+		for (x = 0; x < w; x++) {
+			fd_rgb(src, y * w + x, bpp, &r, &g, &b);
+			*py++ = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+		}
+
+	for (y = 0; y < h; y += 2)
+		for (x = 0; x < w; x += 2) {
+			sr = sg = sb = n = 0;
+			for (dy = 0; dy < 2 && y + dy < h; dy++)
+				for (dx = 0; dx < 2 && x + dx < w; dx++, n++) {
+					fd_rgb(src, (y + dy) * w + x + dx, bpp, &r, &g, &b);
+					sr += r; sg += g; sb += b;
+				}
+			sr /= n; sg /= n; sb /= n;
+			*pu++ = ((-38 * sr - 74 * sg + 112 * sb + 128) >> 8) + 128;
+			*pv++ = ((112 * sr - 94 * sg - 18 * sb + 128) >> 8) + 128;
+		}
+}
+
+static void fd_index(unsigned int num, int w, int h, int bpp,
+	unsigned long long offset, size_t size, unsigned long long hash)
+{
+	fprintf(fd.idx, "%u %d %d %d %llu %lu %016llx\n", num, w, h, bpp,
+		offset, (unsigned long)size, hash);
+}
+
+/* on the worker, or the caller if there is no thread */
+static void fd_write(struct fd_frame *f)
+{
+	unsigned long long hash, offset = fd.offset;
+	size_t size = 0, hdr_size;
+	char hdr[64];
+
+	hash = fd_hash(f->pixels, f->w, f->h, f->bpp, f->w * f->bpp / 8);
+
+	if (fd.format == FRAMEDUMP_RAW) {
+		size = (size_t)f->w * f->h * f->bpp / 8;
+		if (fwrite(f->pixels, 1, size, fd.out) != size)
+			size = 0;
+	}
+	else if (fd.y4m_w == 0 || (f->w == fd.y4m_w && f->h == fd.y4m_h)) {
+		size = f->w * f->h + 2 * ((f->w + 1) / 2) * ((f->h + 1) / 2);
+		if (fd.y4m_w == 0) {
+			fd.yuv = malloc(size);
+			if (fd.yuv == NULL) {
+				fprintf(stderr, "framedump: OOM\n");
+				fd.y4m_w = -1; // every frame is skipped
+				size = 0;
+				goto skip;
+			}
+			fd.y4m_w = f->w;
+			fd.y4m_h = f->h;
+			hdr_size = snprintf(hdr, sizeof(hdr),
+				"YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n",
+				f->w, f->h, fd.fps);
+			fwrite(hdr, 1, hdr_size, fd.out);
+			fd.offset += hdr_size;
+			offset = fd.offset;
+		}
+		fd_to_yuv420(fd.yuv, f->pixels, f->w, f->h, f->bpp);
+		// offset points to the data, past "FRAME\n"
+		fwrite("FRAME\n", 1, 6, fd.out);
+		offset += 6;
+		fd.offset += 6;
+		if (fwrite(fd.yuv, 1, size, fd.out) != size)
+			size = 0;
+	}
+	else {
+skip:
+		pthread_mutex_lock(&fd_mutex);
+		fd.stats.skipped++;
+		pthread_mutex_unlock(&fd_mutex);
+		offset = 0;
+	}
+
+	fd.offset += size;
+	fd_index(f->num, f->w, f->h, f->bpp, offset, size, hash);
+
+	pthread_mutex_lock(&fd_mutex);
+	fd.stats.bytes += size;
+	pthread_mutex_unlock(&fd_mutex);
+}
+
+static void *fd_thread(void *arg)
+{
+	int i;
+
+	pthread_mutex_lock(&fd_mutex);
+	for (;;) {
+		while (fd.q_len == 0 && !fd.stop)
+			pthread_cond_wait(&fd_cond, &fd_mutex);
+		if (fd.q_len == 0)
+			break;
+
+		i = fd.queue[fd.q_head];
+		pthread_mutex_unlock(&fd_mutex);
+
+		fd_write(&fd.frames[i]);
+
+		pthread_mutex_lock(&fd_mutex);
+		// dequeued only now, so an empty queue means all is written
+		fd.q_head = (fd.q_head + 1) % FRAMEDUMP_MAX_QUEUE;
+		fd.q_len--;
+		fd.free_list[fd.free_count++] = i;
+		pthread_cond_broadcast(&fd_cond);
+	}
+	pthread_mutex_unlock(&fd_mutex);
+
+	return NULL;
+}
+
+int framedump_start(const char *path, int format, int fps, int queue_frames)
+{
+	char idx_path[512];
+	int i;
+
+	if (fd.active)
+		framedump_stop();
+
+	memset(&fd.stats, 0, sizeof(fd.stats));
+	fd.format = format;
+	fd.fps = fps > 0 ? fps : 60;
+	fd.offset = 0;
+	fd.next_num = 0;
+	fd.y4m_w = fd.y4m_h = 0;
+
+	snprintf(idx_path, sizeof(idx_path), "%s.idx", path);
+	fd.idx = fopen(idx_path, "w");
+	if (fd.idx == NULL) {
+		fprintf(stderr, "framedump: can't open %s\n", idx_path);
+		return -1;
+	}
+	fprintf(fd.idx, "# frame w h bpp offset size hash\n");
+	if (format == FRAMEDUMP_HASH) {
+		fd.active = 1;
+		return 0;
+	}
+
+	fd.out = fopen(path, "wb");
+	if (fd.out == NULL) {
+		fprintf(stderr, "framedump: can't open %s\n", path);
+		fclose(fd.idx);
+		fd.idx = NULL;
+		return -1;
+	}
+
+	if (queue_frames <= 0)
+		queue_frames = FRAMEDUMP_QUEUE;
+	if (queue_frames > FRAMEDUMP_MAX_QUEUE)
+		queue_frames = FRAMEDUMP_MAX_QUEUE;
+	fd.stop = 0;
+	fd.q_head = fd.q_len = 0;
+	fd.free_count = 0;
+	for (i = 0; i < queue_frames; i++)
+		fd.free_list[fd.free_count++] = i;
+
+	fd.threaded = pthread_create(&fd.thread, NULL, fd_thread, NULL) == 0;
+	if (!fd.threaded)
+		fprintf(stderr, "framedump: no thread, writing on flip\n");
+	fd.active = 1;
+
+	return 0;
+}
+
+int framedump_active(void)
+{
+	return fd.active;
+}
+
+void framedump_frame(const void *fb, int w, int h, int bpp, int pitch)
+{
+	size_t line = w * bpp / 8, size = line * h;
+	unsigned int t = 0;
+	struct fd_frame *f;
+	void *tmp;
+	int i, y;
+
+	if (!fd.active || fb == NULL || (bpp != 16 && bpp != 32))
+		return;
+
+	if (fd.format == FRAMEDUMP_HASH) {
+		fd_index(fd.next_num++, w, h, bpp, 0, 0, fd_hash(fb, w, h, bpp, pitch));
+		fd.stats.frames++;
+		return;
+	}
+
+	pthread_mutex_lock(&fd_mutex);
+	if (fd.threaded && fd.free_count == 0) {
+		t = plat_get_ticks_us();
+		while (fd.free_count == 0)
+			pthread_cond_wait(&fd_cond, &fd_mutex);
+		fd.stats.wait_us += plat_get_ticks_us() - t;
+	}
+	i = fd.threaded ? fd.free_list[--fd.free_count] : 0;
+	pthread_mutex_unlock(&fd_mutex);
+
+	f = &fd.frames[i];
+	if (f->alloc < size) {
+		tmp = realloc(f->pixels, size);
+		if (tmp == NULL) {
+			fprintf(stderr, "framedump: OOM\n");
+			if (fd.threaded) {
+				pthread_mutex_lock(&fd_mutex);
+				fd.free_list[fd.free_count++] = i;
+				pthread_mutex_unlock(&fd_mutex);
+			}
+			return;
+		}
+		f->pixels = tmp;
+		f->alloc = size;
+	}
+	if (pitch == (int)line)
+		memcpy(f->pixels, fb, size);
+	else
+		for (y = 0; y < h; y++)
+			memcpy((char *)f->pixels + y * line,
+				(const char *)fb + y * pitch, line);
+	f->w = w;
+	f->h = h;
+	f->bpp = bpp;
+	f->num = fd.next_num++;
+
+	pthread_mutex_lock(&fd_mutex);
+	fd.stats.frames++;
+	if (fd.threaded) {
+		fd.queue[(fd.q_head + fd.q_len) % FRAMEDUMP_MAX_QUEUE] = i;
+		fd.q_len++;
+		pthread_cond_broadcast(&fd_cond);
+	}
+	pthread_mutex_unlock(&fd_mutex);
+
+	if (!fd.threaded)
+		fd_write(f);
+}
+
+void framedump_stop(void)
+{
+	int i;
+
+	if (!fd.active)
+		return;
+
+	if (fd.threaded) {
+		pthread_mutex_lock(&fd_mutex);
+		fd.stop = 1;
+		pthread_cond_broadcast(&fd_cond);
+		pthread_mutex_unlock(&fd_mutex);
+		pthread_join(fd.thread, NULL);
+		fd.threaded = 0;
+	}
+
+	if (fd.out != NULL)
+		fclose(fd.out);
+	fclose(fd.idx);
+	fd.out = fd.idx = NULL;
+	for (i = 0; i < FRAMEDUMP_MAX_QUEUE; i++) {
+		free(fd.frames[i].pixels);
+		fd.frames[i].pixels = NULL;
+		fd.frames[i].alloc = 0;
+	}
+	free(fd.yuv);
+	fd.yuv = NULL;
+	fd.active = 0;
+}
+
+void framedump_get_stats(struct framedump_stats *stats)
+{
+	pthread_mutex_lock(&fd_mutex);
+	*stats = fd.stats;
+	pthread_mutex_unlock(&fd_mutex);
+}
@@ -0,0 +1,34 @@
+#ifndef LIBPICOFE_FRAMEDUMP_H
+#define LIBPICOFE_FRAMEDUMP_H
+
+/* Dumps every flipped frame to a file for golden-output diffing and
+ * for measuring fps with I/O in the loop. Frames are copied into a
+ * bounded queue and written by a background thread; when it's full
+ * the flip waits, so no frame is ever lost. Next to the output a
+ * text index <path>.idx gets one line per frame:
+ *   frame w h bpp offset size hash
+ * hash is the same line hash plat_offscreen keeps. */
+
+#define FRAMEDUMP_Y4M	0	// 4:2:0 Y4M, BT.601, size fixed by the 1st frame
+#define FRAMEDUMP_RAW	1	// frames as given (RGB565/XRGB8888), packed
+#define FRAMEDUMP_HASH	2	// the index only, nothing is queued
+
+struct framedump_stats {
+	unsigned int frames;
+	unsigned int skipped;		// size didn't match the Y4M stream
+	unsigned long long bytes;
+	unsigned long long wait_us;	// flips waiting for the queue
+};
+
+/* queue_frames 0 picks the default, fps only goes to the Y4M header */
+int  framedump_start(const char *path, int format, int fps, int queue_frames);
+int  framedump_active(void);
+
+/* for flip functions, pitch is in bytes */
+void framedump_frame(const void *fb, int w, int h, int bpp, int pitch);
+
+/* writes out everything queued and closes the files */
+void framedump_stop(void);
+void framedump_get_stats(struct framedump_stats *stats);
+
+#endif // LIBPICOFE_FRAMEDUMP_H
@@ -5,6 +5,7 @@
 #include <GLES/gl.h>
 #include "gl_platform.h"
 #include "gl.h"
+#include "framedump.h"
 
 static EGLDisplay edpy;
 static EGLSurface esfc;
@@ -165,6 +166,8 @@ int gl_flip(const void *fb, int w, int h)
 			GL_RGB, GL_UNSIGNED_SHORT_5_6_5, fb);
 		if (gl_have_error("glTexSubImage2D"))
 			return -1;
+
+		framedump_frame(fb, w, h, 16, w * 2);
 	}
 
 	glVertexPointer(3, GL_FLOAT, 0, vertices);
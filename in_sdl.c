@@ -11,6 +11,9 @@
 
 #include <stdio.h>
 #include <SDL.h>
+#ifdef SDL_VIDEO_DRIVER_X11
+#include <SDL_syswm.h>
+#endif
 #include "input.h"
 #include "in_sdl.h"
 
@@ -659,6 +662,28 @@ static int in_sdl_update_keycode(void *drv_data, int *is_down)
 	return ret_kc;
 }
 
+/* SDL 1.2 can't block with a timeout, but on X11 the key events
+ * all come through the connection fd */
+static int in_sdl_get_wait_hnd(void *drv_data)
+{
+#ifdef SDL_VIDEO_DRIVER_X11
+	struct in_sdl_state *state = drv_data;
+	SDL_SysWMinfo info;
+
+	// joysticks are polled in SDL_PumpEvents(), and anything already
+	// queued or delayed by mod key handling would wait for X
+	if (state->joy != NULL || state->delayed_key != 0
+	    || SDL_WasInit(SDL_INIT_EVENTTHREAD)
+	    || SDL_PeepEvents(NULL, 0, SDL_PEEKEVENT, SDL_ALLEVENTS & ~JOY_EVENTS) > 0)
+		return -1;
+
+	SDL_VERSION(&info.version);
+	if (SDL_GetWMInfo(&info) == 1 && info.subsystem == SDL_SYSWM_X11)
+		return ConnectionNumber(info.info.x11.display);
+#endif
+	return -1;
+}
+
 static int in_sdl_menu_translate(void *drv_data, int keycode, char *charcode)
 {
 	struct in_sdl_state *state = drv_data;
@@ -759,6 +784,7 @@ static const in_drv_t in_sdl_drv = {
 	.get_key_names  = in_sdl_get_key_names,
 	.update         = in_sdl_update,
 	.update_keycode = in_sdl_update_keycode,
+	.get_wait_hnd   = in_sdl_get_wait_hnd,
 	.menu_translate = in_sdl_menu_translate,
 	.clean_binds    = in_sdl_clean_binds,
 	.get_config     = in_sdl_get_config,
@@ -26,6 +26,7 @@ typedef struct
 {
 	int drv_id;
 	int drv_fd_hnd;
+	int wait_hnd;	/* async: get_wait_hnd() one in the wait set, or -1 */
 	void *drv_data;
 	char *name;
 	int key_count;
@@ -46,6 +47,10 @@ static int menu_last_used_dev = 0;
 static int menu_key_prev = 0;
 static int menu_key_mask = 0;
 static int menu_key_repeat = 0;
+static int in_ready[IN_MAX_DEVS];	/* handles reported ready, not read yet */
+static int in_ready_count;
+static volatile int in_woken;	/* in_wakeup() called, not consumed yet */
+static unsigned int in_hotplug_ticks;
 
 #define DRV(id) in_drivers[id]
 
@@ -78,8 +83,65 @@ static int *in_alloc_binds(int drv_id, int key_count)
 	return binds;
 }
 
+/* stop waiting on hnd, also if it was already reported ready */
+static void in_wait_remove(int hnd)
+{
+	int i;
+
+	plat_wait_remove(hnd);
+	for (i = 0; i < in_ready_count; ) {
+		if (in_ready[i] != hnd) {
+			i++;
+			continue;
+		}
+		in_ready_count--;
+		memmove(in_ready + i, in_ready + i + 1,
+			(in_ready_count - i) * sizeof(in_ready[0]));
+	}
+}
+
+/* drivers may give several devices the same wait handle */
+static int in_wait_hnd_used(int hnd, const in_dev_t *except)
+{
+	int i;
+
+	for (i = 0; i < in_dev_count; i++)
+		if (&in_devices[i] != except && in_devices[i].probed
+		    && in_devices[i].wait_hnd == hnd)
+			return 1;
+	return 0;
+}
+
+/* for async devices: returns the handle to wait on, -1 if the device
+ * has to be polled right now. The handle is put in the wait set once
+ * and stays there until it changes or the device goes away. */
+static int in_async_wait_hnd(in_dev_t *dev)
+{
+	int hnd = -1;
+
+	if (DRV(dev->drv_id).get_wait_hnd != NULL)
+		hnd = DRV(dev->drv_id).get_wait_hnd(dev->drv_data);
+	if (hnd < 0 || hnd == dev->wait_hnd)
+		return hnd;
+
+	if (dev->wait_hnd != -1 && !in_wait_hnd_used(dev->wait_hnd, dev))
+		in_wait_remove(dev->wait_hnd);
+	dev->wait_hnd = -1;
+	if (plat_wait_add(hnd) != 0)
+		return -1;
+	dev->wait_hnd = hnd;
+
+	return hnd;
+}
+
 static void in_unprobe(in_dev_t *dev)
 {
+	if (dev->probed && dev->drv_fd_hnd != -1)
+		in_wait_remove(dev->drv_fd_hnd);
+	if (dev->probed && dev->wait_hnd != -1
+	    && !in_wait_hnd_used(dev->wait_hnd, dev))
+		in_wait_remove(dev->wait_hnd);
+	dev->wait_hnd = -1;
 	if (dev->probed)
 		DRV(dev->drv_id).free(dev->drv_data);
 	dev->probed = 0;
@@ -160,7 +222,12 @@ update:
 	in_devices[i].drv_id = in_probe_dev_id;
 	in_devices[i].drv_fd_hnd = drv_fd_hnd;
 	in_devices[i].key_names = key_names;
+	if (drv_fd_hnd != -1)
+		plat_wait_add(drv_fd_hnd);
 	in_devices[i].drv_data = drv_data;
+	in_devices[i].wait_hnd = -1;
+	if (drv_fd_hnd == -1)
+		in_async_wait_hnd(&in_devices[i]);
 
 	if (in_devices[i].binds != NULL) {
 		ret = DRV(in_probe_dev_id).clean_binds(drv_data, in_devices[i].binds,
@@ -173,6 +240,51 @@ update:
 	}
 }
 
+/* to be called by drivers, for devices that went away;
+ * the binds are kept for when it's back */
+void in_unregister(void *drv_data)
+{
+	int i;
+
+	for (i = 0; i < in_dev_count; i++) {
+		if (!in_devices[i].probed || in_devices[i].drv_data != drv_data)
+			continue;
+
+		lprintf("input: device #%d \"%s\" removed\n", i, in_devices[i].name);
+		in_unprobe(&in_devices[i]);
+		if (menu_last_used_dev == i)
+			menu_last_used_dev = 0;
+		break;
+	}
+}
+
+/* let drivers add/drop hotplugged devices, for the driver watching
+ * hnd or all of them if it's -1; returns 1 if any was called */
+static int in_hotplug(int hnd)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < in_driver_count; i++) {
+		if (DRV(i).hotplug == NULL || DRV(i).get_hotplug_hnd == NULL)
+			continue;
+		if (hnd != -1 && DRV(i).get_hotplug_hnd(&DRV(i)) != hnd)
+			continue;
+
+		in_probe_dev_id = i;
+		DRV(i).hotplug(&DRV(i));
+		ret = 1;
+	}
+
+	if (ret) {
+		in_have_async_devs = 0;
+		for (i = 0; i < in_dev_count; i++)
+			if (in_devices[i].probed && in_devices[i].drv_fd_hnd == -1)
+				in_have_async_devs = 1;
+	}
+
+	return ret;
+}
+
 /* key combo handling, to be called by drivers that support it.
  * Only care about IN_BINDTYPE_EMU */
 void in_combos_find(const int *binds, int last_key, int *combo_keys, int *combo_acts)
@@ -245,6 +357,7 @@ void in_probe(void)
 	int i;
 
 	in_have_async_devs = 0;
+	in_ready_count = 0;
 	menu_key_state = 0;
 	menu_last_used_dev = 0;
 
@@ -254,6 +367,11 @@ void in_probe(void)
 	for (i = 0; i < in_driver_count; i++) {
 		in_probe_dev_id = i;
 		in_drivers[i].probe(&DRV(i));
+		if (DRV(i).get_hotplug_hnd != NULL && DRV(i).hotplug != NULL) {
+			int hnd = DRV(i).get_hotplug_hnd(&DRV(i));
+			if (hnd != -1)
+				plat_wait_add(hnd);
+		}
 	}
 
 	/* get rid of devs without binds and probes */
@@ -282,8 +400,15 @@ void in_probe(void)
 /* async update */
 int in_update(int *result)
 {
+	unsigned int ticks = plat_get_ticks_ms();
 	int i, ret = 0;
 
+	/* nothing waits on the hotplug handles while in game */
+	if (ticks - in_hotplug_ticks >= 1000) {
+		in_hotplug_ticks = ticks;
+		in_hotplug(-1);
+	}
+
 	for (i = 0; i < in_dev_count; i++) {
 		in_dev_t *dev = &in_devices[i];
 		if (dev->probed && dev->binds != NULL)
@@ -313,21 +438,27 @@ int in_update_analog(int dev_id, int axis_id, int *result)
 
 static int in_update_kc_async(int *dev_id_out, int *is_down_out, int timeout_ms)
 {
-	int i, is_down, result;
+	int i, is_down, result, waitable, wait, ret;
+	int ready[IN_MAX_DEVS];
 	unsigned int ticks;
 
 	ticks = plat_get_ticks_ms();
 
 	while (1)
 	{
+		waitable = 1;
 		for (i = 0; i < in_dev_count; i++) {
 			in_dev_t *d = &in_devices[i];
 			if (!d->probed)
 				continue;
 
 			result = DRV(d->drv_id).update_keycode(d->drv_data, &is_down);
-			if (result == -1)
+			if (result == -1) {
+				/* fd devices are in the wait set since in_register() */
+				if (d->drv_fd_hnd == -1 && in_async_wait_hnd(d) < 0)
+					waitable = 0;
 				continue;
+			}
 
 			if (dev_id_out)
 				*dev_id_out = i;
@@ -336,10 +467,24 @@ static int in_update_kc_async(int *dev_id_out, int *is_down_out, int timeout_ms)
 			return result;
 		}
 
-		if (timeout_ms >= 0 && (int)(plat_get_ticks_ms() - ticks) > timeout_ms)
-			break;
-
-		plat_sleep_ms(10);
+		wait = -1;
+		if (timeout_ms >= 0) {
+			wait = timeout_ms - (int)(plat_get_ticks_ms() - ticks);
+			if (wait <= 0)
+				break;
+		}
+		/* someone can only be polled, but other devices and
+		 * in_wakeup() still end the wait early */
+		if (!waitable && (wait < 0 || wait > 10))
+			wait = 10;
+
+		ret = plat_wait_events(ready, IN_MAX_DEVS, wait);
+		for (i = 0; i < ret; i++)
+			in_hotplug(ready[i]);
+		if (ret < 0)
+			plat_sleep_ms(10);
+		else if (ret == 0 && in_woken && timeout_ms >= 0)
+			break; /* in_wakeup() */
 	}
 
 	return -1;
@@ -351,8 +496,7 @@ static int in_update_kc_async(int *dev_id_out, int *is_down_out, int timeout_ms)
 int in_update_keycode(int *dev_id_out, int *is_down_out, char *charcode, int timeout_ms)
 {
 	int result = -1, dev_id = 0, is_down, result_menu;
-	int fds_hnds[IN_MAX_DEVS];
-	int i, ret, count = 0;
+	int i, hnd, ret, count = 0;
 	in_drv_t *drv = NULL;
 	unsigned int ticks;
 
@@ -368,7 +512,13 @@ int in_update_keycode(int *dev_id_out, int *is_down_out, char *charcode, int tim
 
 	for (i = 0; i < in_dev_count; i++) {
 		if (in_devices[i].probed)
-			fds_hnds[count++] = in_devices[i].drv_fd_hnd;
+			count++;
+	}
+	/* with hotplug, waiting is fine, a device may come back */
+	for (i = 0; i < in_driver_count && count == 0; i++) {
+		if (DRV(i).get_hotplug_hnd != NULL && DRV(i).hotplug != NULL
+		    && DRV(i).get_hotplug_hnd(&DRV(i)) != -1)
+			count++;
 	}
 
 	if (count == 0) {
@@ -379,26 +529,43 @@ int in_update_keycode(int *dev_id_out, int *is_down_out, char *charcode, int tim
 
 	while (1)
 	{
-		ret = plat_wait_event(fds_hnds, count, timeout_ms);
-		if (ret < 0)
-			break;
-
-		for (i = 0; i < in_dev_count; i++) {
-			if (in_devices[i].drv_fd_hnd == ret) {
-				dev_id = i;
+		if (in_ready_count == 0) {
+			ret = plat_wait_events(in_ready, IN_MAX_DEVS, timeout_ms);
+			if (ret < 0)
 				break;
-			}
+			if (ret == 0 && timeout_ms >= 0)
+				break; /* timeout or in_wakeup() */
+			in_ready_count = ret;
 		}
 
-		drv = &DRV(in_devices[dev_id].drv_id);
-		result = drv->update_keycode(in_devices[dev_id].drv_data, &is_down);
-		if (result >= 0)
-			break;
+		/* one event per ready device in turn, so all get served */
+		dev_id = -1;
+		if (in_ready_count > 0) {
+			hnd = in_ready[0];
+			in_ready_count--;
+			memmove(in_ready, in_ready + 1, in_ready_count * sizeof(in_ready[0]));
+
+			for (i = 0; i < in_dev_count; i++)
+				if (in_devices[i].probed && in_devices[i].drv_fd_hnd == hnd)
+					dev_id = i;
+			/* nobody's, don't let it keep the wait busy */
+			if (dev_id < 0 && !in_hotplug(hnd))
+				in_wait_remove(hnd);
+			if (in_have_async_devs)
+				break; /* hotplugged, those need the async loop */
+		}
 
-		if (result == -2) {
-			lprintf("input: \"%s\" errored out, removing.\n", in_devices[dev_id].name);
-			in_unprobe(&in_devices[dev_id]);
-			break;
+		if (dev_id >= 0) {
+			drv = &DRV(in_devices[dev_id].drv_id);
+			result = drv->update_keycode(in_devices[dev_id].drv_data, &is_down);
+			if (result >= 0)
+				break;
+
+			if (result == -2) {
+				lprintf("input: \"%s\" errored out, removing.\n", in_devices[dev_id].name);
+				in_unprobe(&in_devices[dev_id]);
+				break;
+			}
 		}
 
 		if (timeout_ms >= 0) {
@@ -453,26 +620,85 @@ int in_menu_wait_any(char *charcode, int timeout_ms)
 	return ret;
 }
 
-/* wait for menu input, do autorepeat */
-int in_menu_wait(int interesting, char *charcode, int autorep_delay_ms)
+/* returns and clears the in_wakeup() flag */
+static int in_woken_take(void)
+{
+	return __sync_fetch_and_and(&in_woken, 0);
+}
+
+/* wait for menu input, do autorepeat.
+ * Gives up and returns 0 after timeout_ms (-1 waits forever), so the
+ * caller can do background work; autorepeat timing carries over. */
+int in_menu_wait_timeout(int interesting, char *charcode, int autorep_delay_ms,
+	int timeout_ms)
 {
-	int ret, wait = 450;
+	static unsigned int repeat_start;
+	static int repeat_resume;
+	unsigned int wait_start, start = plat_get_ticks_ms();
+	int ret, keys, timed, woken, left, first = 1, wait = 450;
 
 	if (menu_key_repeat)
 		wait = autorep_delay_ms;
 
+	if (repeat_resume) {
+		/* last call timed out during the repeat delay, continue it */
+		wait -= start - repeat_start;
+		if (wait < 0)
+			wait = 0;
+	}
+	else
+		repeat_start = start;
+	repeat_resume = 0;
+
+	/* a wakeup from before this wait is stale, the caller is
+	 * about to redraw anyway */
+	in_woken_take();
+
 	/* wait until either key repeat or a new key has been pressed */
-	do {
+	while (1) {
+		timed = 0;
+		if (timeout_ms >= 0) {
+			left = timeout_ms - (int)(plat_get_ticks_ms() - start);
+			if (left < 0)
+				left = 0;
+			if (wait < 0 || wait > left) {
+				wait = left;
+				timed = 1;
+			}
+		}
+
+		keys = menu_key_state;
+		wait_start = plat_get_ticks_ms();
 		ret = in_menu_wait_any(charcode, wait);
+		woken = ret == keys && in_woken_take();
+		if (ret == keys && timeout_ms >= 0 && (woken
+		    || (timed && (int)(plat_get_ticks_ms() - start) >= timeout_ms))) {
+			repeat_resume = first;
+			return 0;
+		}
+		if (woken) {
+			/* nobody waits for it, and it only cut the
+			 * repeat delay short, keep waiting */
+			if (wait > 0) {
+				wait -= plat_get_ticks_ms() - wait_start;
+				if (wait < 0)
+					wait = 0;
+			}
+			continue;
+		}
+
 		if (ret == 0 || ret != menu_key_prev)
 			menu_key_repeat = 0;
 		else
 			menu_key_repeat++;
 		wait = -1;
+		first = 0;
 	 	/* mask away all old keys if an additional new key is pressed */
 		/* XXX what if old and new keys share bits (PBTN_CHAR)? */
 		ret &= ~menu_key_mask;
-	} while (!(ret & interesting));
+		if (ret & interesting)
+			break;
+	}
 
 	/* we don't need diagonals in menus */
 	if (ret & (PBTN_UP|PBTN_DOWN))  ret &= ~(PBTN_LEFT|PBTN_RIGHT);
@@ -480,6 +706,19 @@ int in_menu_wait(int interesting, char *charcode, int autorep_delay_ms)
 	return ret;
 }
 
+/* may be called from any thread, makes a pending
+ * in_menu_wait_timeout() with a timeout return now */
+void in_wakeup(void)
+{
+	__sync_fetch_and_or(&in_woken, 1);
+	plat_wait_wakeup();
+}
+
+int in_menu_wait(int interesting, char *charcode, int autorep_delay_ms)
+{
+	return in_menu_wait_timeout(interesting, charcode, autorep_delay_ms, -1);
+}
+
 const int *in_get_dev_binds(int dev_id)
 {
 	in_dev_t *dev = get_dev(dev_id);
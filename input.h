@@ -92,9 +92,17 @@ struct InputDriver {
 	int  (*update_analog)(void *drv_data, int axis_id, int *result);
 	/* return -1 on no event, -2 on error */
 	int  (*update_keycode)(void *drv_data, int *is_down);
+	/* optional, for async devices: a handle that becomes readable
+	 * once update_keycode() may return something, or -1 */
+	int  (*get_wait_hnd)(void *drv_data);
 	int  (*menu_translate)(void *drv_data, int keycode, char *charcode);
 	int  (*get_key_code)(const char *key_name);
 	const char * (*get_key_name)(int keycode);
+	/* optional: a handle that becomes readable when devices come or
+	 * go, hotplug() then adds/drops just those with in_register()
+	 * and in_unregister() */
+	int  (*get_hotplug_hnd)(const in_drv_t *drv);
+	void (*hotplug)(const in_drv_t *drv);
 
 	const struct in_default_bind *defbinds;
 	const void *pdata;
@@ -133,6 +141,7 @@ int  in_register_driver(const in_drv_t *drv,
 			const struct in_default_bind *defbinds, const void *pdata);
 void in_register(const char *nname, int drv_fd_hnd, void *drv_data,
 		int key_count, const char * const *key_names, int combos);
+void in_unregister(void *drv_data);
 void in_combos_find(const int *binds, int last_key, int *combo_keys, int *combo_acts);
 int  in_combos_do(int keys, const int *binds, int last_key, int combo_keys, int combo_acts);
 
@@ -143,6 +152,9 @@ int  in_update_analog(int dev_id, int axis_id, int *value);
 int  in_update_keycode(int *dev_id, int *is_down, char *charcode, int timeout_ms);
 int  in_menu_wait_any(char *charcode, int timeout_ms);
 int  in_menu_wait(int interesting, char *charcode, int autorep_delay_ms);
+void in_wakeup(void);
+int  in_menu_wait_timeout(int interesting, char *charcode, int autorep_delay_ms,
+		int timeout_ms);
 int  in_config_parse_dev(const char *dev_name);
 int  in_config_bind_key(int dev_id, const char *key, int binds, int bind_type);
 int  in_get_config(int dev_id, int what, void *val);
@@ -17,11 +17,14 @@
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/time.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <linux/fb.h>
 #include <linux/matroxfb.h>
 
 #include "fbdev.h"
+#include "../fastmem.h"
 
 #define PFX "fbdev: "
 
@@ -37,8 +40,173 @@ struct vout_fbdev {
 	int	top_border, bottom_border;
 	void	*mem_saved;
 	size_t	mem_saved_size;
+	int	buffer_disp;		/* buffer currently scanned out */
+	/* flip thread state, protected by flip_mutex */
+	int	flip_mode;
+	int	flip_thread_active;
+	int	flip_thread_stop;
+	int	flip_busy;		/* thread is between pan and vsync */
+	int	*flip_queue;		/* buffer_count entries */
+	int	flip_queue_len;
+	unsigned int vsync_time;	/* plat_get_ticks_us() clock */
+	unsigned int vsync_count;
+	pthread_t	flip_thread;
+	pthread_mutex_t	flip_mutex;
+	pthread_cond_t	flip_cond;
+	/* vout_fbdev_present() state: copy of what each buffer holds */
+	void	*shadow;
+	unsigned long long *shadow_hash;	/* per buffer per line */
+	int	*shadow_valid;		/* buffer_count entries */
+	int	state_count;		/* allocated flip_queue/shadow_valid */
+	int	shadow_w, shadow_h, shadow_bpp, shadow_count;
 };
 
+static void fbdev_present_invalidate(struct vout_fbdev *fbdev)
+{
+	if (fbdev->shadow_valid != NULL)
+		memset(fbdev->shadow_valid, 0,
+			fbdev->state_count * sizeof(fbdev->shadow_valid[0]));
+}
+
+/* grow the per buffer state, the flip queue must be empty */
+static int fbdev_alloc_state(struct vout_fbdev *fbdev, int count)
+{
+	int *queue, *valid;
+
+	if (count <= fbdev->state_count)
+		return 0;
+
+	queue = calloc(count, sizeof(queue[0]));
+	valid = calloc(count, sizeof(valid[0]));
+	if (queue == NULL || valid == NULL) {
+		fprintf(stderr, PFX "OOM for buffer state\n");
+		free(queue);
+		free(valid);
+		return -1;
+	}
+
+	pthread_mutex_lock(&fbdev->flip_mutex);
+	free(fbdev->flip_queue);
+	free(fbdev->shadow_valid);
+	fbdev->flip_queue = queue;
+	fbdev->shadow_valid = valid;
+	fbdev->state_count = count;
+	pthread_mutex_unlock(&fbdev->flip_mutex);
+
+	return 0;
+}
+
+static unsigned int fbdev_get_ticks_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (unsigned)tv.tv_sec * 1000000 + (unsigned)tv.tv_usec;
+}
+
+static void fbdev_pan(struct vout_fbdev *fbdev, int buf)
+{
+	fbdev->fbvar_new.yoffset =
+		(fbdev->top_border + fbdev->fbvar_new.yres + fbdev->bottom_border) * buf +
+		fbdev->top_border;
+
+	ioctl(fbdev->fd, FBIOPAN_DISPLAY, &fbdev->fbvar_new);
+}
+
+static int fbdev_buffer_is_free(struct vout_fbdev *fbdev, int buf)
+{
+	int i;
+
+	if (buf == fbdev->buffer_disp)
+		return 0;
+	for (i = 0; i < fbdev->flip_queue_len; i++)
+		if (fbdev->flip_queue[i] == buf)
+			return 0;
+	return 1;
+}
+
+static void *fbdev_flip_thread(void *arg)
+{
+	struct vout_fbdev *fbdev = arg;
+	int vsync_arg, buf;
+
+	pthread_mutex_lock(&fbdev->flip_mutex);
+	while (1) {
+		while (fbdev->flip_queue_len == 0 && !fbdev->flip_thread_stop)
+			pthread_cond_wait(&fbdev->flip_cond, &fbdev->flip_mutex);
+		if (fbdev->flip_thread_stop)
+			break;
+
+		buf = fbdev->flip_queue[0];
+		fbdev->flip_busy = 1;
+		pthread_mutex_unlock(&fbdev->flip_mutex);
+
+		// pan takes effect on next vblank, the old buffer is
+		// only safe to draw to after that
+		fbdev_pan(fbdev, buf);
+		vsync_arg = 0;
+		ioctl(fbdev->fd, FBIO_WAITFORVSYNC, &vsync_arg);
+
+		pthread_mutex_lock(&fbdev->flip_mutex);
+		fbdev->vsync_time = fbdev_get_ticks_us();
+		fbdev->vsync_count++;
+		fbdev->buffer_disp = buf;
+		fbdev->flip_queue_len--;
+		memmove(&fbdev->flip_queue[0], &fbdev->flip_queue[1],
+			fbdev->flip_queue_len * sizeof(fbdev->flip_queue[0]));
+		fbdev->flip_busy = 0;
+		pthread_cond_broadcast(&fbdev->flip_cond);
+	}
+	pthread_mutex_unlock(&fbdev->flip_mutex);
+
+	return NULL;
+}
+
+/* wait until everything queued is on screen */
+static void fbdev_flip_thread_sync(struct vout_fbdev *fbdev)
+{
+	if (!fbdev->flip_thread_active)
+		return;
+
+	pthread_mutex_lock(&fbdev->flip_mutex);
+	while (fbdev->flip_queue_len > 0 || fbdev->flip_busy)
+		pthread_cond_wait(&fbdev->flip_cond, &fbdev->flip_mutex);
+	pthread_mutex_unlock(&fbdev->flip_mutex);
+}
+
+static void *fbdev_flip_threaded(struct vout_fbdev *fbdev, int draw_buf)
+{
+	int i;
+
+	pthread_mutex_lock(&fbdev->flip_mutex);
+
+	// mailbox: anything not yet picked up by the thread gets dropped
+	// (the head entry may already be getting panned)
+	if (fbdev->flip_mode == FBDEV_FLIP_MAILBOX && fbdev->flip_queue_len > 0)
+		fbdev->flip_queue_len = fbdev->flip_busy ? 1 : 0;
+
+	fbdev->flip_queue[fbdev->flip_queue_len++] = draw_buf;
+	pthread_cond_broadcast(&fbdev->flip_cond);
+
+	// block until there is some buffer we can draw to
+	while (1) {
+		for (i = 1; i <= fbdev->buffer_count; i++) {
+			int buf = (draw_buf + i) % fbdev->buffer_count;
+			if (fbdev_buffer_is_free(fbdev, buf))
+				break;
+		}
+		if (i <= fbdev->buffer_count) {
+			fbdev->buffer_write = (draw_buf + i) % fbdev->buffer_count;
+			break;
+		}
+		pthread_cond_wait(&fbdev->flip_cond, &fbdev->flip_mutex);
+	}
+
+	pthread_mutex_unlock(&fbdev->flip_mutex);
+
+	return (char *)fbdev->mem + fbdev->fb_size * fbdev->buffer_write;
+}
+
 void *vout_fbdev_flip(struct vout_fbdev *fbdev)
 {
 	int draw_buf;
@@ -47,15 +215,15 @@ void *vout_fbdev_flip(struct vout_fbdev *fbdev)
 		return fbdev->mem;
 
 	draw_buf = fbdev->buffer_write;
+	if (fbdev->flip_thread_active)
+		return fbdev_flip_threaded(fbdev, draw_buf);
+
 	fbdev->buffer_write++;
 	if (fbdev->buffer_write >= fbdev->buffer_count)
 		fbdev->buffer_write = 0;
 
-	fbdev->fbvar_new.yoffset = 
-		(fbdev->top_border + fbdev->fbvar_new.yres + fbdev->bottom_border) * draw_buf +
-		fbdev->top_border;
-
-	ioctl(fbdev->fd, FBIOPAN_DISPLAY, &fbdev->fbvar_new);
+	fbdev_pan(fbdev, draw_buf);
+	fbdev->buffer_disp = draw_buf;
 
 	return (char *)fbdev->mem + fbdev->fb_size * fbdev->buffer_write;
 }
@@ -63,9 +231,79 @@ void *vout_fbdev_flip(struct vout_fbdev *fbdev)
 void vout_fbdev_wait_vsync(struct vout_fbdev *fbdev)
 {
 	int arg = 0;
+
+	if (fbdev->flip_thread_active) {
+		unsigned int count;
+
+		// the thread is already sitting in a vsync wait,
+		// just let it tell us when it's done
+		pthread_mutex_lock(&fbdev->flip_mutex);
+		if (fbdev->flip_queue_len > 0 || fbdev->flip_busy) {
+			count = fbdev->vsync_count;
+			while (fbdev->vsync_count == count)
+				pthread_cond_wait(&fbdev->flip_cond, &fbdev->flip_mutex);
+			pthread_mutex_unlock(&fbdev->flip_mutex);
+			return;
+		}
+		pthread_mutex_unlock(&fbdev->flip_mutex);
+	}
+
 	ioctl(fbdev->fd, FBIO_WAITFORVSYNC, &arg);
 }
 
+int vout_fbdev_set_flip_mode(struct vout_fbdev *fbdev, int mode)
+{
+	int ret;
+
+	if (mode == fbdev->flip_mode)
+		return 0;
+
+	if (fbdev->flip_thread_active) {
+		fbdev_flip_thread_sync(fbdev);
+		pthread_mutex_lock(&fbdev->flip_mutex);
+		fbdev->flip_thread_stop = 1;
+		pthread_cond_broadcast(&fbdev->flip_cond);
+		pthread_mutex_unlock(&fbdev->flip_mutex);
+		pthread_join(fbdev->flip_thread, NULL);
+		fbdev->flip_thread_active = 0;
+		fbdev->flip_thread_stop = 0;
+	}
+	fbdev->flip_mode = FBDEV_FLIP_SYNC;
+
+	if (mode == FBDEV_FLIP_SYNC)
+		return 0;
+	if (mode != FBDEV_FLIP_MAILBOX && mode != FBDEV_FLIP_FIFO)
+		return -1;
+
+	fbdev->flip_queue_len = 0;
+	fbdev->flip_busy = 0;
+	ret = pthread_create(&fbdev->flip_thread, NULL, fbdev_flip_thread, fbdev);
+	if (ret != 0) {
+		fprintf(stderr, PFX "pthread_create failed: %d\n", ret);
+		return -1;
+	}
+	fbdev->flip_thread_active = 1;
+	fbdev->flip_mode = mode;
+
+	return 0;
+}
+
+int vout_fbdev_get_vsync_time(struct vout_fbdev *fbdev, unsigned int *time_us,
+	unsigned int *count)
+{
+	if (!fbdev->flip_thread_active)
+		return -1;
+
+	pthread_mutex_lock(&fbdev->flip_mutex);
+	if (time_us != NULL)
+		*time_us = fbdev->vsync_time;
+	if (count != NULL)
+		*count = fbdev->vsync_count;
+	pthread_mutex_unlock(&fbdev->flip_mutex);
+
+	return 0;
+}
+
 /* it is recommended to call vout_fbdev_clear() before this */
 void *vout_fbdev_resize(struct vout_fbdev *fbdev, int w, int h, int bpp,
 		      int left_border, int right_border, int top_border, int bottom_border, int buffer_cnt)
@@ -75,6 +313,11 @@ void *vout_fbdev_resize(struct vout_fbdev *fbdev, int w, int h, int bpp,
 	size_t mem_size;
 	int ret;
 
+	fbdev_flip_thread_sync(fbdev);
+	if (fbdev_alloc_state(fbdev, buffer_cnt) != 0)
+		return NULL;
+	fbdev_present_invalidate(fbdev);
+
 	// unblank to be sure the mode is really accepted
 	ioctl(fbdev->fd, FBIOBLANK, FB_BLANK_UNBLANK);
 
@@ -100,6 +343,7 @@ void *vout_fbdev_resize(struct vout_fbdev *fbdev, int w, int h, int bpp,
 		fbdev->fbvar_new.nonstd = 0; // can set YUV here on omapfb
 		fbdev->buffer_count = buffer_cnt;
 		fbdev->buffer_write = buffer_cnt > 1 ? 1 : 0;
+		fbdev->buffer_disp = 0;
 
 		// seems to help a bit to avoid glitches
 		vout_fbdev_wait_vsync(fbdev);
@@ -155,7 +399,9 @@ out:
 
 void vout_fbdev_clear(struct vout_fbdev *fbdev)
 {
-	memset(fbdev->mem, 0, fbdev->mem_size);
+	fbdev_flip_thread_sync(fbdev);
+	fastmem_clear(fbdev->mem, fbdev->mem_size);
+	fbdev_present_invalidate(fbdev);
 }
 
 void vout_fbdev_clear_lines(struct vout_fbdev *fbdev, int y, int count)
@@ -166,9 +412,112 @@ void vout_fbdev_clear_lines(struct vout_fbdev *fbdev, int y, int count)
 	if (y + count > fbdev->top_border + fbdev->fbvar_new.yres)
 		count = fbdev->top_border + fbdev->fbvar_new.yres - y;
 
-	if (y >= 0 && count > 0)
+	fbdev_flip_thread_sync(fbdev);
+
+	if (y >= 0 && count > 0) {
 		for (i = 0; i < fbdev->buffer_count; i++)
-			memset((char *)fbdev->mem + fbdev->fb_size * i + y * stride, 0, stride * count);
+			fastmem_clear((char *)fbdev->mem + fbdev->fb_size * i + y * stride, stride * count);
+		fbdev_present_invalidate(fbdev);
+	}
+}
+
+#define PRESENT_CHUNK 32
+
+/* copy changed parts of one line, dst is framebuffer, shadow what's in it */
+static void fbdev_present_line(char *dst, char *shadow, const char *src, int bytes)
+{
+	int x, start = -1;
+
+	for (x = 0; x < bytes; x += PRESENT_CHUNK) {
+		int len = bytes - x < PRESENT_CHUNK ? bytes - x : PRESENT_CHUNK;
+		int same = memcmp(shadow + x, src + x, len) == 0;
+		if (!same && start < 0)
+			start = x;
+		else if (same && start >= 0) {
+			fastmem_copy(dst + start, src + start, x - start);
+			memcpy(shadow + start, src + start, x - start);
+			start = -1;
+		}
+	}
+	if (start >= 0) {
+		fastmem_copy(dst + start, src + start, bytes - start);
+		memcpy(shadow + start, src + start, bytes - start);
+	}
+}
+
+static int fbdev_present_alloc(struct vout_fbdev *fbdev, int w, int h, int bpp)
+{
+	size_t size;
+
+	if (fbdev->shadow != NULL && fbdev->shadow_w == w && fbdev->shadow_h == h
+	    && fbdev->shadow_bpp == bpp && fbdev->shadow_count == fbdev->buffer_count)
+		return 0;
+
+	free(fbdev->shadow);
+	free(fbdev->shadow_hash);
+	fbdev_present_invalidate(fbdev);
+
+	size = (size_t)w * h * bpp / 8;
+	fbdev->shadow = malloc(size * fbdev->buffer_count);
+	fbdev->shadow_hash = malloc(sizeof(fbdev->shadow_hash[0]) * h * fbdev->buffer_count);
+	if (fbdev->shadow == NULL || fbdev->shadow_hash == NULL) {
+		fprintf(stderr, PFX "OOM for present shadow\n");
+		free(fbdev->shadow);
+		free(fbdev->shadow_hash);
+		fbdev->shadow = NULL;
+		fbdev->shadow_hash = NULL;
+		return -1;
+	}
+	fbdev->shadow_w = w;
+	fbdev->shadow_h = h;
+	fbdev->shadow_bpp = bpp;
+	fbdev->shadow_count = fbdev->buffer_count;
+
+	return 0;
+}
+
+void *vout_fbdev_present(struct vout_fbdev *fbdev, const void *src, int src_pitch)
+{
+	int w = fbdev->fbvar_new.xres;
+	int h = fbdev->fbvar_new.yres;
+	int bpp = fbdev->fbvar_new.bits_per_pixel;
+	int stride = fbdev->fbvar_new.xres_virtual * bpp / 8;
+	int line_bytes = w * bpp / 8;
+	int buf = fbdev->buffer_write;
+	unsigned long long hash, *hashes;
+	char *dst, *shadow;
+	const char *s = src;
+	int y, valid;
+
+	dst = (char *)fbdev->mem + fbdev->fb_size * buf
+		+ fbdev->top_border * stride + fbdev->fbvar_new.xoffset * bpp / 8;
+
+	if (fbdev_present_alloc(fbdev, w, h, bpp) != 0) {
+		// no memory for tracking, just do plain copies
+		for (y = 0; y < h; y++, s += src_pitch, dst += stride)
+			fastmem_copy(dst, s, line_bytes);
+		return vout_fbdev_flip(fbdev);
+	}
+
+	shadow = (char *)fbdev->shadow + (size_t)line_bytes * h * buf;
+	hashes = fbdev->shadow_hash + h * buf;
+	valid = fbdev->shadow_valid[buf];
+
+	for (y = 0; y < h; y++, s += src_pitch, dst += stride, shadow += line_bytes) {
+		hash = fastmem_hash(s, line_bytes);
+		if (valid && hashes[y] == hash)
+			continue;
+		if (valid)
+			fbdev_present_line(dst, shadow, s, line_bytes);
+		else {
+			fastmem_copy(dst, s, line_bytes);
+			memcpy(shadow, s, line_bytes);
+		}
+		hashes[y] = hash;
+	}
+	fbdev->shadow_valid[buf] = 1;
+
+	return vout_fbdev_flip(fbdev);
 }
 
 int vout_fbdev_get_fd(struct vout_fbdev *fbdev)
@@ -187,6 +536,9 @@ struct vout_fbdev *vout_fbdev_init(const char *fbdev_name, int *w, int *h, int b
 	if (fbdev == NULL)
 		return NULL;
 
+	pthread_mutex_init(&fbdev->flip_mutex, NULL);
+	pthread_cond_init(&fbdev->flip_cond, NULL);
+
 	fbdev->fd = open(fbdev_name, O_RDWR);
 	if (fbdev->fd == -1) {
 		fprintf(stderr, PFX "%s: ", fbdev_name);
@@ -218,7 +570,7 @@ struct vout_fbdev *vout_fbdev_init(const char *fbdev_name, int *w, int *h, int b
 	*w = fbdev->fbvar_new.xres;
 	*h = fbdev->fbvar_new.yres;
 
-	memset(fbdev->mem, 0, fbdev->mem_size);
+	fastmem_clear(fbdev->mem, fbdev->mem_size);
 
 	// some checks
 	ret = 0;
@@ -228,6 +580,7 @@ struct vout_fbdev *vout_fbdev_init(const char *fbdev_name, int *w, int *h, int b
 
 	if (fbdev->buffer_count > 1) {
 		fbdev->buffer_write = 0;
+		fbdev->buffer_disp = fbdev->buffer_count - 1;
 		fbdev->fbvar_new.yoffset = fbdev->fbvar_new.yres * (fbdev->buffer_count - 1);
 		ret = ioctl(fbdev->fd, FBIOPAN_DISPLAY, &fbdev->fbvar_new);
 		if (ret != 0) {
@@ -242,6 +595,8 @@ struct vout_fbdev *vout_fbdev_init(const char *fbdev_name, int *w, int *h, int b
 fail:
 	close(fbdev->fd);
 fail_open:
+	pthread_cond_destroy(&fbdev->flip_cond);
+	pthread_mutex_destroy(&fbdev->flip_mutex);
 	free(fbdev);
 	return NULL;
 }
@@ -263,6 +618,8 @@ int vout_fbdev_save(struct vout_fbdev *fbdev)
 		return -1;
 	}
 
+	fbdev_flip_thread_sync(fbdev);
+
 	if (fbdev->mem_saved_size < fbdev->mem_size) {
 		tmp = realloc(fbdev->mem_saved, fbdev->mem_size);
 		if (tmp == NULL)
@@ -291,6 +648,7 @@ int vout_fbdev_restore(struct vout_fbdev *fbdev)
 		return -1;
 	}
 	memcpy(fbdev->mem, fbdev->mem_saved, fbdev->mem_size);
+	fbdev_present_invalidate(fbdev);
 
 	ret = ioctl(fbdev->fd, FBIOPUT_VSCREENINFO, &fbdev->fbvar_new);
 	if (ret == -1) {
@@ -303,7 +661,14 @@ int vout_fbdev_restore(struct vout_fbdev *fbdev)
 
 void vout_fbdev_finish(struct vout_fbdev *fbdev)
 {
+	vout_fbdev_set_flip_mode(fbdev, FBDEV_FLIP_SYNC);
+	pthread_cond_destroy(&fbdev->flip_cond);
+	pthread_mutex_destroy(&fbdev->flip_mutex);
 	vout_fbdev_release(fbdev);
+	free(fbdev->shadow);
+	free(fbdev->shadow_hash);
+	free(fbdev->shadow_valid);
+	free(fbdev->flip_queue);
 	if (fbdev->fd >= 0)
 		close(fbdev->fd);
 	fbdev->fd = -1;
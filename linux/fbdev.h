@@ -1,5 +1,16 @@
 struct vout_fbdev;
 
+/* flip modes, for threaded ones vout_fbdev_flip() only queues the buffer
+ * and returns next one to draw to, vsync waits and pans happen on a
+ * separate thread.
+ * MAILBOX: newest frame replaces any frame still waiting to be shown
+ * FIFO:    every frame is shown, flip blocks when all buffers are queued */
+enum {
+	FBDEV_FLIP_SYNC = 0,
+	FBDEV_FLIP_MAILBOX,
+	FBDEV_FLIP_FIFO,
+};
+
 struct vout_fbdev *vout_fbdev_init(const char *fbdev_name, int *w, int *h, int bpp, int buffer_count);
 void *vout_fbdev_flip(struct vout_fbdev *fbdev);
 void  vout_fbdev_wait_vsync(struct vout_fbdev *fbdev);
@@ -12,3 +23,12 @@ int   vout_fbdev_get_fd(struct vout_fbdev *fbdev);
 int   vout_fbdev_save(struct vout_fbdev *fbdev);
 int   vout_fbdev_restore(struct vout_fbdev *fbdev);
 void  vout_fbdev_finish(struct vout_fbdev *fbdev);
+/* copy a frame from system memory into the current draw buffer and flip.
+ * Only lines/spans that differ from what that buffer already holds are
+ * written. Don't mix with drawing directly into the buffers. */
+void *vout_fbdev_present(struct vout_fbdev *fbdev, const void *src, int src_pitch);
+int   vout_fbdev_set_flip_mode(struct vout_fbdev *fbdev, int mode);
+/* time (plat_get_ticks_us() clock) and count of the last vsync seen by
+ * the flip thread, returns -1 if the thread is not running */
+int   vout_fbdev_get_vsync_time(struct vout_fbdev *fbdev, unsigned int *time_us,
+				unsigned int *count);
@@ -17,6 +17,7 @@
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
+#include <sys/inotify.h>
 #include <linux/input.h>
 #include <errno.h>
 
@@ -25,9 +26,14 @@
 
 #define MAX_ABS_DEVS 8
 
-typedef struct {
+#ifndef SYN_DROPPED
+#define SYN_DROPPED 3
+#endif
+
+typedef struct in_evdev {
 	int fd;
-	int *kbits;
+	int num; /* N of /dev/input/eventN */
+	int *kbits; /* key state, tracked from events */
 	int abs_min_x; /* abs->digital mapping */
 	int abs_max_x;
 	int abs_min_y;
@@ -40,9 +46,13 @@ typedef struct {
 	unsigned int abs_count;
 	int abs_mult[MAX_ABS_DEVS]; /* 16.16 multiplier to IN_ABS_RANGE */
 	int abs_adj[MAX_ABS_DEVS];  /* adjust for centering */
+	int abs_value[MAX_ABS_DEVS]; /* tracked from events */
 	unsigned int abs_to_digital:1;
+	unsigned int kbits_ioctl:1; /* EVIOCGKEY works, for resync */
+	unsigned int dropped:1;     /* SYN_DROPPED, resync on SYN_REPORT */
 
 	const in_drv_t *drv;
+	struct in_evdev *next;
 } in_evdev_t;
 
 #ifndef KEY_CNT
@@ -60,6 +70,9 @@ typedef struct {
 
 int in_evdev_allow_abs_only;
 
+static in_evdev_t *in_evdev_devs;	/* open ones, for hotplug */
+static int in_evdev_notify_fd = -1;
+
 #define IN_EVDEV_PREFIX "evdev:"
 
 static const char * const in_evdev_keys[KEY_CNT] = {
@@ -149,143 +162,210 @@ static const char * const in_evdev_keys[KEY_CNT] = {
 };
 
 
-static void in_evdev_probe(const in_drv_t *drv)
+/* returns -1 if there is no such node */
+static int in_evdev_open(const in_drv_t *drv, int num)
 {
 	long keybits[KEY_CNT / sizeof(long) / 8];
 	long absbits[(ABS_MAX+1) / sizeof(long) / 8];
-	int i;
+	int support = 0, count = 0;
+	int u, ret, fd, kc_first = KEY_MAX, kc_last = 0, have_abs = 0;
+	in_evdev_t *dev;
+	char name[64];
 
 	// the kernel might support and return less keys then we know about,
 	// so make sure the buffers are clear.
 	memset(keybits, 0, sizeof(keybits));
 	memset(absbits, 0, sizeof(absbits));
 
-	for (i = 0;; i++)
-	{
-		int support = 0, count = 0;
-		int u, ret, fd, kc_first = KEY_MAX, kc_last = 0, have_abs = 0;
-		in_evdev_t *dev;
-		char name[64];
-
-		snprintf(name, sizeof(name), "/dev/input/event%d", i);
-		fd = open(name, O_RDONLY|O_NONBLOCK);
-		if (fd == -1) {
-			if (errno == EACCES)
-				continue;	/* maybe we can access next one */
-			break;
-		}
+	snprintf(name, sizeof(name), "/dev/input/event%d", num);
+	fd = open(name, O_RDONLY|O_NONBLOCK);
+	if (fd == -1) {
+		if (errno == EACCES)
+			return 0;	/* maybe we can access next one */
+		return -1;
+	}
 
-		/* check supported events */
-		ret = ioctl(fd, EVIOCGBIT(0, sizeof(support)), &support);
+	/* check supported events */
+	ret = ioctl(fd, EVIOCGBIT(0, sizeof(support)), &support);
+	if (ret == -1) {
+		printf("in_evdev: ioctl failed on %s\n", name);
+		goto skip;
+	}
+
+	if (support & (1 << EV_KEY)) {
+		ret = ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keybits)), keybits);
 		if (ret == -1) {
 			printf("in_evdev: ioctl failed on %s\n", name);
 			goto skip;
 		}
 
-		if (support & (1 << EV_KEY)) {
-			ret = ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keybits)), keybits);
-			if (ret == -1) {
-				printf("in_evdev: ioctl failed on %s\n", name);
-				goto skip;
-			}
-
-			/* check for interesting keys */
-			for (u = 0; u < KEY_CNT; u++) {
-				if (KEYBITS_BIT(u)) {
-					if (u < kc_first)
-						kc_first = u;
-					if (u > kc_last)
-						kc_last = u;
-					if (u != KEY_POWER && u != KEY_SLEEP && u != BTN_TOUCH)
-						count++;
-					if (u == BTN_TOUCH) /* we can't deal with ts currently */
-						goto skip;
-				}
+		/* check for interesting keys */
+		for (u = 0; u < KEY_CNT; u++) {
+			if (KEYBITS_BIT(u)) {
+				if (u < kc_first)
+					kc_first = u;
+				if (u > kc_last)
+					kc_last = u;
+				if (u != KEY_POWER && u != KEY_SLEEP && u != BTN_TOUCH)
+					count++;
+				if (u == BTN_TOUCH) /* we can't deal with ts currently */
+					goto skip;
 			}
 		}
+	}
 
-		dev = calloc(1, sizeof(*dev));
-		if (dev == NULL)
-			goto skip;
+	dev = calloc(1, sizeof(*dev));
+	if (dev == NULL)
+		goto skip;
 
-		dev->drv = drv;
+	dev->drv = drv;
 
-		ret = ioctl(fd, EVIOCGKEY(sizeof(keybits)), keybits);
-		if (ret == -1) {
-			printf("Warning: EVIOCGKEY not supported, will have to track state\n");
-			dev->kbits = calloc(KEY_CNT, sizeof(int));
-			if (dev->kbits == NULL) {
-				free(dev);
-				goto skip;
-			}
+	dev->kbits = calloc(1, KEY_CNT / 8);
+	if (dev->kbits == NULL) {
+		free(dev);
+		goto skip;
+	}
+	ret = ioctl(fd, EVIOCGKEY(KEY_CNT / 8), dev->kbits);
+	if (ret == -1)
+		printf("Warning: EVIOCGKEY not supported, can't resync key state\n");
+	else
+		dev->kbits_ioctl = 1;
+
+	/* check for abs too */
+	if (support & (1 << EV_ABS)) {
+		struct input_absinfo ainfo;
+		int dist;
+		ret = ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(absbits)), absbits);
+		if (ret == -1)
+			goto no_abs;
+		if (absbits[0] & (1 << ABS_X)) {
+			ret = ioctl(fd, EVIOCGABS(ABS_X), &ainfo);
+			if (ret == -1)
+				goto no_abs;
+			dist = ainfo.maximum - ainfo.minimum;
+			dev->abs_lzone = dist / 4;
+			dev->abs_min_x = ainfo.minimum;
+			dev->abs_max_x = ainfo.maximum;
 		}
-
-		/* check for abs too */
-		if (support & (1 << EV_ABS)) {
-			struct input_absinfo ainfo;
-			int dist;
-			ret = ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(absbits)), absbits);
+		if (absbits[0] & (1 << ABS_Y)) {
+			ret = ioctl(fd, EVIOCGABS(ABS_Y), &ainfo);
 			if (ret == -1)
 				goto no_abs;
-			if (absbits[0] & (1 << ABS_X)) {
-				ret = ioctl(fd, EVIOCGABS(ABS_X), &ainfo);
-				if (ret == -1)
-					goto no_abs;
-				dist = ainfo.maximum - ainfo.minimum;
-				dev->abs_lzone = dist / 4;
-				dev->abs_min_x = ainfo.minimum;
-				dev->abs_max_x = ainfo.maximum;
-			}
-			if (absbits[0] & (1 << ABS_Y)) {
-				ret = ioctl(fd, EVIOCGABS(ABS_Y), &ainfo);
-				if (ret == -1)
-					goto no_abs;
-				dist = ainfo.maximum - ainfo.minimum;
-				dev->abs_min_y = ainfo.minimum;
-				dev->abs_max_y = ainfo.maximum;
-			}
-			for (u = 0; u < MAX_ABS_DEVS; u++) {
-				ret = ioctl(fd, EVIOCGABS(u), &ainfo);
-				if (ret == -1)
-					break;
-				dist = ainfo.maximum - ainfo.minimum;
-				if (dist != 0)
-					dev->abs_mult[u] = IN_ABS_RANGE * 2 * 65536 / dist;
-				dev->abs_adj[u] = -(ainfo.maximum + ainfo.minimum + 1) / 2;
-				have_abs = 1;
-			}
-			dev->abs_count = u;
+			dist = ainfo.maximum - ainfo.minimum;
+			dev->abs_min_y = ainfo.minimum;
+			dev->abs_max_y = ainfo.maximum;
 		}
+		for (u = 0; u < MAX_ABS_DEVS; u++) {
+			ret = ioctl(fd, EVIOCGABS(u), &ainfo);
+			if (ret == -1)
+				break;
+			dist = ainfo.maximum - ainfo.minimum;
+			if (dist != 0)
+				dev->abs_mult[u] = IN_ABS_RANGE * 2 * 65536 / dist;
+			dev->abs_adj[u] = -(ainfo.maximum + ainfo.minimum + 1) / 2;
+			dev->abs_value[u] = ainfo.value;
+			have_abs = 1;
+		}
+		dev->abs_count = u;
+	}
 
 no_abs:
-		if (count == 0 && !have_abs) {
-			free(dev);
-			goto skip;
-		}
+	if (count == 0 && !have_abs) {
+		free(dev->kbits);
+		free(dev);
+		goto skip;
+	}
 
-		dev->fd = fd;
-		dev->kc_first = kc_first;
-		dev->kc_last = kc_last;
-		if (count > 0 || in_evdev_allow_abs_only)
-			dev->abs_to_digital = 1;
-		strcpy(name, IN_EVDEV_PREFIX);
-		ioctl(fd, EVIOCGNAME(sizeof(name)-6), name+6);
-		printf("in_evdev: found \"%s\" with %d events (type %08x)\n",
-			name+6, count, support);
-		in_register(name, fd, dev, KEY_CNT, in_evdev_keys, 0);
-		continue;
+	dev->fd = fd;
+	dev->num = num;
+	dev->kc_first = kc_first;
+	dev->kc_last = kc_last;
+	if (count > 0 || in_evdev_allow_abs_only)
+		dev->abs_to_digital = 1;
+	dev->next = in_evdev_devs;
+	in_evdev_devs = dev;
+	strcpy(name, IN_EVDEV_PREFIX);
+	ioctl(fd, EVIOCGNAME(sizeof(name)-6), name+6);
+	printf("in_evdev: found \"%s\" with %d events (type %08x)\n",
+		name+6, count, support);
+	in_register(name, fd, dev, KEY_CNT, in_evdev_keys, 0);
+	return 0;
 
 skip:
-		close(fd);
+	close(fd);
+	return 0;
+}
+
+static void in_evdev_probe(const in_drv_t *drv)
+{
+	int i;
+
+	/* watch before scanning, so nothing added in between is missed */
+	if (in_evdev_notify_fd == -1) {
+		in_evdev_notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (in_evdev_notify_fd != -1 && inotify_add_watch(in_evdev_notify_fd,
+		    "/dev/input", IN_CREATE | IN_ATTRIB | IN_DELETE) == -1) {
+			perror("in_evdev: inotify_add_watch");
+			close(in_evdev_notify_fd);
+			in_evdev_notify_fd = -2; /* don't retry */
+		}
+	}
+
+	for (i = 0;; i++)
+		if (in_evdev_open(drv, i) != 0)
+			break;
+}
+
+static int in_evdev_get_hotplug_hnd(const in_drv_t *drv)
+{
+	return in_evdev_notify_fd >= 0 ? in_evdev_notify_fd : -1;
+}
+
+/* open added nodes (IN_ATTRIB: udev may fix permissions later),
+ * drop removed ones; devices already open are left alone */
+static void in_evdev_hotplug(const in_drv_t *drv)
+{
+	char buf[1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	in_evdev_t *dev;
+	int rd, num;
+	char *p;
+
+	if (in_evdev_notify_fd < 0)
+		return;
+
+	while ((rd = read(in_evdev_notify_fd, buf, sizeof(buf))) > 0) {
+		for (p = buf; p < buf + rd; p += sizeof(*ev) + ev->len) {
+			ev = (const void *)p;
+			if (ev->len == 0 || sscanf(ev->name, "event%d", &num) != 1)
+				continue;
+
+			for (dev = in_evdev_devs; dev != NULL; dev = dev->next)
+				if (dev->num == num)
+					break;
+
+			if (ev->mask & IN_DELETE) {
+				if (dev != NULL)
+					in_unregister(dev);
+			}
+			else if (dev == NULL)
+				in_evdev_open(drv, num);
+		}
 	}
 }
 
 static void in_evdev_free(void *drv_data)
 {
-	in_evdev_t *dev = drv_data;
+	in_evdev_t *dev = drv_data, **pp;
 	if (dev == NULL)
 		return;
+	for (pp = &in_evdev_devs; *pp != NULL; pp = &(*pp)->next)
+		if (*pp == dev) {
+			*pp = dev->next;
+			break;
+		}
 	close(dev->fd);
+	free(dev->kbits);
 	free(dev);
 }
 
@@ -307,42 +387,66 @@ static void or_binds(const int *binds, int key, int *result)
 		result[t] |= binds[IN_BIND_OFFS(key, t)];
 }
 
-/* ORs result with binds of pressed buttons
- * XXX: should measure performance hit of this func, might need to optimize */
-static int in_evdev_update(void *drv_data, const int *binds, int *result)
+/* only needed after the kernel dropped events or we flushed them,
+ * otherwise the state comes from the event stream */
+static void in_evdev_resync(in_evdev_t *dev)
 {
-	struct input_event ev[16];
 	struct input_absinfo ainfo;
-	int keybits_[KEY_CNT / sizeof(int)];
-	int *keybits = keybits_;
-	in_evdev_t *dev = drv_data;
-	int rd, ret, u, lzone;
+	unsigned int u;
 
-	if (dev->kbits == NULL) {
-		ret = ioctl(dev->fd, EVIOCGKEY(sizeof(keybits_)), keybits_);
-		if (ret == -1) {
-			perror("in_evdev: ioctl failed");
-			return -1;
+	if (!dev->kbits_ioctl
+	    || ioctl(dev->fd, EVIOCGKEY(KEY_CNT / 8), dev->kbits) == -1)
+		memset(dev->kbits, 0, KEY_CNT / 8);
+
+	for (u = 0; u < dev->abs_count; u++)
+		if (ioctl(dev->fd, EVIOCGABS(u), &ainfo) != -1)
+			dev->abs_value[u] = ainfo.value;
+}
+
+static void in_evdev_track(in_evdev_t *dev, const struct input_event *ev)
+{
+	int *keybits = dev->kbits;
+
+	if (ev->type == EV_SYN) {
+		if (ev->code == SYN_DROPPED)
+			dev->dropped = 1;
+		else if (ev->code == SYN_REPORT && dev->dropped) {
+			in_evdev_resync(dev);
+			dev->dropped = 0;
 		}
 	}
-	else {
-		keybits = dev->kbits;
-		while (1) {
-			rd = read(dev->fd, ev, sizeof(ev));
-			if (rd < (int)sizeof(ev[0])) {
-				if (errno != EAGAIN)
-					perror("in_evdev: read failed");
-				break;
-			}
-			for (u = 0; u < rd / sizeof(ev[0]); u++) {
-				if (ev[u].type != EV_KEY)
-					continue;
-				else if (ev[u].value == 1)
-					KEYBITS_BIT_SET(ev[u].code);
-				else if (ev[u].value == 0)
-					KEYBITS_BIT_CLEAR(ev[u].code);
-			}
+	else if (dev->dropped)
+		return; /* incomplete until the next SYN_REPORT */
+	else if (ev->type == EV_KEY && ev->code < KEY_CNT) {
+		if (ev->value == 1)
+			KEYBITS_BIT_SET(ev->code);
+		else if (ev->value == 0)
+			KEYBITS_BIT_CLEAR(ev->code);
+	}
+	else if (ev->type == EV_ABS && ev->code < MAX_ABS_DEVS)
+		dev->abs_value[ev->code] = ev->value;
+}
+
+/* ORs result with binds of pressed buttons */
+static int in_evdev_update(void *drv_data, const int *binds, int *result)
+{
+	struct input_event ev[16];
+	in_evdev_t *dev = drv_data;
+	int *keybits = dev->kbits;
+	int rd, u, lzone;
+
+	while (1) {
+		rd = read(dev->fd, ev, sizeof(ev));
+		if (rd < (int)sizeof(ev[0])) {
+			if (errno != EAGAIN)
+				perror("in_evdev: read failed");
+			break;
 		}
+		for (u = 0; u < rd / sizeof(ev[0]); u++)
+			in_evdev_track(dev, &ev[u]);
+		/* a short read means the queue is empty */
+		if (rd < (int)sizeof(ev))
+			break;
 	}
 
 	for (u = dev->kc_first; u <= dev->kc_last; u++) {
@@ -353,35 +457,24 @@ static int in_evdev_update(void *drv_data, const int *binds, int *result)
 	/* map X and Y absolute to UDLR */
 	lzone = dev->abs_lzone;
 	if (dev->abs_to_digital && lzone != 0) {
-		ret = ioctl(dev->fd, EVIOCGABS(ABS_X), &ainfo);
-		if (ret != -1) {
-			if (ainfo.value < dev->abs_min_x + lzone) or_binds(binds, KEY_LEFT, result);
-			if (ainfo.value > dev->abs_max_x - lzone) or_binds(binds, KEY_RIGHT, result);
-		}
-		ret = ioctl(dev->fd, EVIOCGABS(ABS_Y), &ainfo);
-		if (ret != -1) {
-			if (ainfo.value < dev->abs_min_y + lzone) or_binds(binds, KEY_UP, result);
-			if (ainfo.value > dev->abs_max_y - lzone) or_binds(binds, KEY_DOWN, result);
-		}
+		if (dev->abs_value[ABS_X] < dev->abs_min_x + lzone) or_binds(binds, KEY_LEFT, result);
+		if (dev->abs_value[ABS_X] > dev->abs_max_x - lzone) or_binds(binds, KEY_RIGHT, result);
+		if (dev->abs_value[ABS_Y] < dev->abs_min_y + lzone) or_binds(binds, KEY_UP, result);
+		if (dev->abs_value[ABS_Y] > dev->abs_max_y - lzone) or_binds(binds, KEY_DOWN, result);
 	}
 
 	return 0;
 }
 
+/* uses the state from the last update() or update_keycode() */
 static int in_evdev_update_analog(void *drv_data, int axis_id, int *result)
 {
-	struct input_absinfo ainfo;
 	in_evdev_t *dev = drv_data;
-	int ret;
 
-	if ((unsigned int)axis_id >= MAX_ABS_DEVS)
+	if ((unsigned int)axis_id >= dev->abs_count)
 		return -1;
 
-	ret = ioctl(dev->fd, EVIOCGABS(axis_id), &ainfo);
-	if (ret != 0)
-		return ret;
-
-	*result = (ainfo.value + dev->abs_adj[axis_id]) * dev->abs_mult[axis_id];
+	*result = (dev->abs_value[axis_id] + dev->abs_adj[axis_id]) * dev->abs_mult[axis_id];
 	*result >>= 16;
 	return 0;
 }
@@ -416,6 +509,9 @@ static int in_evdev_set_blocking(in_evdev_t *dev, int y)
 		return -1;
 	}
 
+	/* the flush above skipped the tracking */
+	in_evdev_resync(dev);
+
 	return 0;
 }
 
@@ -479,6 +575,8 @@ static int in_evdev_update_keycode(void *data, int *is_down)
 		goto out;
 	}
 
+	in_evdev_track(dev, &ev);
+
 	if (ev.type == EV_KEY) {
 		if (ev.value < 0 || ev.value > 1)
 			goto out;
@@ -618,6 +716,8 @@ static const in_drv_t in_evdev_drv = {
 	.update_analog  = in_evdev_update_analog,
 	.update_keycode = in_evdev_update_keycode,
 	.menu_translate = in_evdev_menu_translate,
+	.get_hotplug_hnd = in_evdev_get_hotplug_hnd,
+	.hotplug        = in_evdev_hotplug,
 };
 
 int in_evdev_init(const struct in_pdata *pdata)
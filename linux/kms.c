@@ -0,0 +1,699 @@
+/*
+ * DRM/KMS dumb buffer video output, same usage as fbdev.c
+ *
+ * This work is licensed under the terms of any of these licenses
+ * (at your option):
+ *  - GNU GPL, version 2 or later.
+ *  - GNU LGPL, version 2.1 or later.
+ *  - MAME license.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+
+#include "kms.h"
+#include "../fastmem.h"
+
+#define PFX "kms: "
+#define KMS_MAX_BUFFERS 4
+
+struct kms_buffer {
+	uint32_t handle;
+	uint32_t fb_id;
+	uint32_t pitch;
+	uint64_t size;
+	void *mem;
+};
+
+struct vout_kms {
+	int	fd;
+	uint32_t connector_id;
+	uint32_t crtc_id;
+	int	crtc_idx;	/* index in the resources, for vblank waits */
+	uint32_t plane_id;	/* primary plane, atomic only */
+	uint32_t plane_fb_prop;	/* FB_ID property of the plane */
+	int	atomic;
+	drmModeModeInfo mode;
+	drmModeCrtc *crtc_old;
+	struct	kms_buffer bufs[KMS_MAX_BUFFERS];
+	int	buffer_count;
+	int	buffer_write;
+	int	buffer_disp;
+	int	buffer_pending;	/* flip submitted, no event yet, -1 if none */
+	int	w, h, bpp;
+	int	left_border, top_border;
+	int	w_total, h_total;
+	int	x_center, y_center;	/* image offset in a larger mode */
+};
+
+static void kms_free_buffer(struct vout_kms *kms, struct kms_buffer *b)
+{
+	struct drm_mode_destroy_dumb dreq;
+
+	if (b->mem != NULL)
+		munmap(b->mem, b->size);
+	if (b->fb_id)
+		drmModeRmFB(kms->fd, b->fb_id);
+	if (b->handle) {
+		memset(&dreq, 0, sizeof(dreq));
+		dreq.handle = b->handle;
+		drmIoctl(kms->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+	}
+	memset(b, 0, sizeof(*b));
+}
+
+static void kms_free_buffers(struct vout_kms *kms)
+{
+	int i;
+
+	for (i = 0; i < kms->buffer_count; i++)
+		kms_free_buffer(kms, &kms->bufs[i]);
+	kms->buffer_count = 0;
+}
+
+static int kms_alloc_buffer(struct vout_kms *kms, struct kms_buffer *b,
+	int w, int h, int bpp)
+{
+	struct drm_mode_create_dumb creq;
+	struct drm_mode_map_dumb mreq;
+	uint32_t handles[4] = { 0, }, pitches[4] = { 0, }, offsets[4] = { 0, };
+	uint32_t format;
+	int ret;
+
+	format = bpp == 16 ? DRM_FORMAT_RGB565 : DRM_FORMAT_XRGB8888;
+
+	memset(&creq, 0, sizeof(creq));
+	creq.width = w;
+	creq.height = h;
+	creq.bpp = bpp;
+	ret = drmIoctl(kms->fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq);
+	if (ret < 0) {
+		perror(PFX "DRM_IOCTL_MODE_CREATE_DUMB");
+		goto fail;
+	}
+	b->handle = creq.handle;
+	b->pitch = creq.pitch;
+	b->size = creq.size;
+
+	handles[0] = b->handle;
+	pitches[0] = b->pitch;
+	ret = drmModeAddFB2(kms->fd, w, h, format, handles, pitches, offsets,
+		&b->fb_id, 0);
+	if (ret != 0) {
+		fprintf(stderr, PFX "drmModeAddFB2 failed: %d\n", ret);
+		goto fail;
+	}
+
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.handle = b->handle;
+	ret = drmIoctl(kms->fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq);
+	if (ret < 0) {
+		perror(PFX "DRM_IOCTL_MODE_MAP_DUMB");
+		goto fail;
+	}
+
+	b->mem = mmap(0, b->size, PROT_READ|PROT_WRITE, MAP_SHARED, kms->fd, mreq.offset);
+	if (b->mem == MAP_FAILED) {
+		b->mem = NULL;
+		perror(PFX "mmap dumb buffer");
+		goto fail;
+	}
+
+	fastmem_clear(b->mem, b->size);
+	return 0;
+
+fail:
+	kms_free_buffer(kms, b);
+	return -1;
+}
+
+static void kms_page_flip_handler(int fd, unsigned int frame,
+	unsigned int sec, unsigned int usec, void *data)
+{
+	struct vout_kms *kms = data;
+
+	if (kms->buffer_pending >= 0)
+		kms->buffer_disp = kms->buffer_pending;
+	kms->buffer_pending = -1;
+}
+
+/* returns 0 if events were handled, -1 on timeout, -2 on error */
+static int kms_handle_events(struct vout_kms *kms, int timeout_ms)
+{
+	drmEventContext evctx;
+	struct pollfd pfd;
+	int ret;
+
+	pfd.fd = kms->fd;
+	pfd.events = POLLIN;
+	do {
+		ret = poll(&pfd, 1, timeout_ms);
+	} while (ret < 0 && errno == EINTR);
+	if (ret == 0)
+		return -1;
+	if (ret < 0) {
+		perror(PFX "poll");
+		return -2;
+	}
+
+	memset(&evctx, 0, sizeof(evctx));
+	evctx.version = 2;
+	evctx.page_flip_handler = kms_page_flip_handler;
+	drmHandleEvent(kms->fd, &evctx);
+
+	return 0;
+}
+
+/* wait for the outstanding flip to complete */
+static void kms_flip_sync(struct vout_kms *kms)
+{
+	int ret;
+
+	while (kms->buffer_pending >= 0) {
+		ret = kms_handle_events(kms, 1000);
+		if (ret != 0) {
+			// can't wait any more, assume it's done
+			if (ret == -1)
+				fprintf(stderr, PFX "flip event timeout\n");
+			kms->buffer_disp = kms->buffer_pending;
+			kms->buffer_pending = -1;
+		}
+	}
+}
+
+static int kms_submit_flip(struct vout_kms *kms, int buf)
+{
+	uint32_t fb_id = kms->bufs[buf].fb_id;
+	int ret;
+
+	if (kms->atomic) {
+		drmModeAtomicReq *req = drmModeAtomicAlloc();
+		if (req == NULL)
+			return -1;
+		drmModeAtomicAddProperty(req, kms->plane_id, kms->plane_fb_prop, fb_id);
+		ret = drmModeAtomicCommit(kms->fd, req,
+			DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT, kms);
+		drmModeAtomicFree(req);
+	}
+	else
+		ret = drmModePageFlip(kms->fd, kms->crtc_id, fb_id,
+			DRM_MODE_PAGE_FLIP_EVENT, kms);
+
+	if (ret != 0) {
+		fprintf(stderr, PFX "page flip failed: %d\n", ret);
+		return -1;
+	}
+
+	kms->buffer_pending = buf;
+	return 0;
+}
+
+static int kms_buffer_is_free(struct vout_kms *kms, int buf)
+{
+	return buf != kms->buffer_disp && buf != kms->buffer_pending;
+}
+
+static void *kms_buffer_ptr(struct vout_kms *kms, int buf)
+{
+	return (char *)kms->bufs[buf].mem + kms->y_center * kms->bufs[buf].pitch
+		+ kms->x_center * kms->bpp / 8;
+}
+
+void *vout_kms_flip(struct vout_kms *kms)
+{
+	int draw_buf, i;
+
+	if (kms->buffer_count < 2)
+		return kms_buffer_ptr(kms, 0);
+
+	// only one flip can be outstanding on a crtc
+	kms_flip_sync(kms);
+
+	draw_buf = kms->buffer_write;
+	if (kms_submit_flip(kms, draw_buf) != 0)
+		return kms_buffer_ptr(kms, draw_buf);
+
+	// with 2 buffers the one we'd return is still scanned out,
+	// so this waits for the flip; with 3+ it doesn't block
+	while (1) {
+		for (i = 1; i < kms->buffer_count; i++) {
+			int buf = (draw_buf + i) % kms->buffer_count;
+			if (kms_buffer_is_free(kms, buf))
+				break;
+		}
+		if (i < kms->buffer_count) {
+			kms->buffer_write = (draw_buf + i) % kms->buffer_count;
+			break;
+		}
+		kms_flip_sync(kms);
+	}
+
+	return kms_buffer_ptr(kms, kms->buffer_write);
+}
+
+void vout_kms_wait_vsync(struct vout_kms *kms)
+{
+	drmVBlank vbl;
+
+	memset(&vbl, 0, sizeof(vbl));
+	vbl.request.type = DRM_VBLANK_RELATIVE;
+	if (kms->crtc_idx == 1)
+		vbl.request.type |= DRM_VBLANK_SECONDARY;
+	else if (kms->crtc_idx > 1)
+		vbl.request.type |= (kms->crtc_idx << DRM_VBLANK_HIGH_CRTC_SHIFT)
+			& DRM_VBLANK_HIGH_CRTC_MASK;
+	vbl.request.sequence = 1;
+	drmWaitVBlank(kms->fd, &vbl);
+}
+
+static int kms_set_crtc(struct vout_kms *kms, uint32_t fb_id, int x, int y)
+{
+	int ret;
+
+	ret = drmModeSetCrtc(kms->fd, kms->crtc_id, fb_id, x, y,
+		&kms->connector_id, 1, &kms->mode);
+	if (ret != 0) {
+		fprintf(stderr, PFX "drmModeSetCrtc failed: %d\n", ret);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* w == 0 matches any size */
+static int kms_find_mode(struct vout_kms *kms, int w, int h)
+{
+	drmModeConnector *conn;
+	int i, ret = -1;
+
+	conn = drmModeGetConnector(kms->fd, kms->connector_id);
+	if (conn == NULL)
+		return -1;
+
+	// preferred mode first, then anything matching
+	for (i = 0; i < conn->count_modes; i++) {
+		if ((w == 0 || (conn->modes[i].hdisplay == w && conn->modes[i].vdisplay == h))
+		    && (conn->modes[i].type & DRM_MODE_TYPE_PREFERRED)) {
+			kms->mode = conn->modes[i];
+			ret = 0;
+			goto out;
+		}
+	}
+	for (i = 0; i < conn->count_modes; i++) {
+		if (w == 0 || (conn->modes[i].hdisplay == w && conn->modes[i].vdisplay == h)) {
+			kms->mode = conn->modes[i];
+			ret = 0;
+			goto out;
+		}
+	}
+
+out:
+	drmModeFreeConnector(conn);
+	return ret;
+}
+
+/* it is recommended to call vout_kms_clear() before this */
+void *vout_kms_resize(struct vout_kms *kms, int w, int h, int bpp,
+		      int left_border, int right_border, int top_border, int bottom_border,
+		      int buffer_cnt)
+{
+	int w_total = left_border + w + right_border;
+	int h_total = top_border + h + bottom_border;
+	struct kms_buffer bufs[KMS_MAX_BUFFERS];
+	drmModeModeInfo old_mode = kms->mode;
+	int i, count = 0, mode_w, mode_h;
+
+	if (buffer_cnt < 1)
+		buffer_cnt = 1;
+	if (buffer_cnt > KMS_MAX_BUFFERS)
+		buffer_cnt = KMS_MAX_BUFFERS;
+
+	if (kms->buffer_count > 0 && kms->w == w && kms->h == h && kms->bpp == bpp
+	    && kms->w_total == w_total && kms->h_total == h_total
+	    && kms->left_border == left_border && kms->top_border == top_border
+	    && kms->buffer_count == buffer_cnt)
+		goto out;
+
+	if (bpp != 16 && bpp != 32) {
+		fprintf(stderr, PFX "unsupported bpp: %d\n", bpp);
+		return NULL;
+	}
+
+	// no such mode (a game resolution on a panel, say): use the
+	// preferred one and center the image in it
+	if ((kms->mode.hdisplay != w || kms->mode.vdisplay != h)
+	    && kms_find_mode(kms, w, h) != 0 && kms_find_mode(kms, 0, 0) != 0) {
+		fprintf(stderr, PFX "no usable mode\n");
+		goto fail;
+	}
+	mode_w = kms->mode.hdisplay;
+	mode_h = kms->mode.vdisplay;
+	if (mode_w < w || mode_h < h) {
+		fprintf(stderr, PFX "%dx%d doesn't fit in the %dx%d mode\n",
+			w, h, mode_w, mode_h);
+		goto fail;
+	}
+	if (mode_w != w || mode_h != h)
+		printf(PFX "no %dx%d mode, centering in %dx%d\n", w, h, mode_w, mode_h);
+
+	if (kms->w != w || kms->h != h || kms->bpp != bpp)
+		printf(PFX "switching to %dx%d@%d\n", w, h, bpp);
+
+	kms_flip_sync(kms);
+
+	// the old buffers stay on screen until the new ones are set up,
+	// removing a displayed fb would turn the crtc off
+	memset(bufs, 0, sizeof(bufs));
+	for (i = 0; i < buffer_cnt; i++) {
+		if (kms_alloc_buffer(kms, &bufs[i], w_total + mode_w - w,
+				h_total + mode_h - h, bpp) != 0) {
+			if (i == 0)
+				goto fail;
+			fprintf(stderr, PFX "Warning: can't allocate buffer %d, "
+				"using %d buffers\n", i, i);
+			break;
+		}
+		count = i + 1;
+	}
+
+	if (kms_set_crtc(kms, bufs[0].fb_id, left_border, top_border) != 0)
+		goto fail;
+
+	kms_free_buffers(kms);
+	memcpy(kms->bufs, bufs, sizeof(bufs));
+	kms->buffer_count = count;
+	kms->buffer_disp = 0;
+	kms->buffer_write = count > 1 ? 1 : 0;
+
+	kms->w = w;
+	kms->h = h;
+	kms->bpp = bpp;
+	kms->w_total = w_total;
+	kms->h_total = h_total;
+	kms->left_border = left_border;
+	kms->top_border = top_border;
+	kms->x_center = (mode_w - w) / 2;
+	kms->y_center = (mode_h - h) / 2;
+
+out:
+	return kms_buffer_ptr(kms, kms->buffer_write);
+
+fail:
+	// keep the old buffers and mode, they are still displayed
+	for (i = 0; i < count; i++)
+		kms_free_buffer(kms, &bufs[i]);
+	kms->mode = old_mode;
+	return NULL;
+}
+
+void vout_kms_clear(struct vout_kms *kms)
+{
+	int i;
+
+	for (i = 0; i < kms->buffer_count; i++)
+		fastmem_clear(kms->bufs[i].mem, kms->bufs[i].size);
+}
+
+void vout_kms_clear_lines(struct vout_kms *kms, int y, int count)
+{
+	int i;
+
+	if (y + count > kms->top_border + kms->h)
+		count = kms->top_border + kms->h - y;
+
+	if (y >= 0 && count > 0)
+		for (i = 0; i < kms->buffer_count; i++)
+			fastmem_clear((char *)kms->bufs[i].mem
+				+ (kms->y_center + y) * kms->bufs[i].pitch,
+				kms->bufs[i].pitch * count);
+}
+
+int vout_kms_get_fd(struct vout_kms *kms)
+{
+	return kms->fd;
+}
+
+int vout_kms_get_pitch(struct vout_kms *kms)
+{
+	return kms->bufs[0].pitch;
+}
+
+static uint32_t kms_get_prop_id(int fd, uint32_t obj_id, uint32_t obj_type,
+	const char *name)
+{
+	drmModeObjectProperties *props;
+	drmModePropertyRes *prop;
+	uint32_t ret = 0;
+	uint32_t i;
+
+	props = drmModeObjectGetProperties(fd, obj_id, obj_type);
+	if (props == NULL)
+		return 0;
+
+	for (i = 0; i < props->count_props && ret == 0; i++) {
+		prop = drmModeGetProperty(fd, props->props[i]);
+		if (prop == NULL)
+			continue;
+		if (strcmp(prop->name, name) == 0)
+			ret = prop->prop_id;
+		drmModeFreeProperty(prop);
+	}
+	drmModeFreeObjectProperties(props);
+
+	return ret;
+}
+
+static uint64_t kms_get_prop_value(int fd, uint32_t obj_id, uint32_t obj_type,
+	const char *name)
+{
+	drmModeObjectProperties *props;
+	drmModePropertyRes *prop;
+	uint64_t ret = 0;
+	uint32_t i;
+
+	props = drmModeObjectGetProperties(fd, obj_id, obj_type);
+	if (props == NULL)
+		return 0;
+
+	for (i = 0; i < props->count_props; i++) {
+		prop = drmModeGetProperty(fd, props->props[i]);
+		if (prop == NULL)
+			continue;
+		if (strcmp(prop->name, name) == 0)
+			ret = props->prop_values[i];
+		drmModeFreeProperty(prop);
+	}
+	drmModeFreeObjectProperties(props);
+
+	return ret;
+}
+
+/* find primary plane for our crtc, needed for atomic flips */
+static int kms_setup_atomic(struct vout_kms *kms)
+{
+	drmModePlaneRes *pres;
+	drmModePlane *plane;
+	int ret = -1;
+	uint32_t i;
+
+	if (drmSetClientCap(kms->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) != 0)
+		return -1;
+	if (drmSetClientCap(kms->fd, DRM_CLIENT_CAP_ATOMIC, 1) != 0)
+		return -1;
+
+	pres = drmModeGetPlaneResources(kms->fd);
+	if (pres == NULL)
+		goto fail;
+
+	for (i = 0; i < pres->count_planes && ret != 0; i++) {
+		plane = drmModeGetPlane(kms->fd, pres->planes[i]);
+		if (plane == NULL)
+			continue;
+		if ((plane->possible_crtcs & (1 << kms->crtc_idx))
+		    && kms_get_prop_value(kms->fd, plane->plane_id, DRM_MODE_OBJECT_PLANE,
+				"type") == DRM_PLANE_TYPE_PRIMARY)
+		{
+			kms->plane_id = plane->plane_id;
+			kms->plane_fb_prop = kms_get_prop_id(kms->fd, plane->plane_id,
+				DRM_MODE_OBJECT_PLANE, "FB_ID");
+			if (kms->plane_fb_prop != 0)
+				ret = 0;
+		}
+		drmModeFreePlane(plane);
+	}
+	drmModeFreePlaneResources(pres);
+
+	if (ret == 0)
+		return 0;
+
+fail:
+	drmSetClientCap(kms->fd, DRM_CLIENT_CAP_ATOMIC, 0);
+	return -1;
+}
+
+static int kms_find_output(struct vout_kms *kms, drmModeRes *res)
+{
+	drmModeConnector *conn = NULL;
+	drmModeEncoder *enc;
+	int i, j;
+
+	for (i = 0; i < res->count_connectors; i++) {
+		conn = drmModeGetConnector(kms->fd, res->connectors[i]);
+		if (conn == NULL)
+			continue;
+		if (conn->connection == DRM_MODE_CONNECTED && conn->count_modes > 0)
+			break;
+		drmModeFreeConnector(conn);
+		conn = NULL;
+	}
+	if (conn == NULL) {
+		fprintf(stderr, PFX "no connected outputs\n");
+		return -1;
+	}
+
+	kms->connector_id = conn->connector_id;
+	kms->mode = conn->modes[0];
+	for (i = 0; i < conn->count_modes; i++) {
+		if (conn->modes[i].type & DRM_MODE_TYPE_PREFERRED) {
+			kms->mode = conn->modes[i];
+			break;
+		}
+	}
+
+	// prefer the crtc already driving this connector
+	kms->crtc_id = 0;
+	if (conn->encoder_id) {
+		enc = drmModeGetEncoder(kms->fd, conn->encoder_id);
+		if (enc != NULL) {
+			kms->crtc_id = enc->crtc_id;
+			drmModeFreeEncoder(enc);
+		}
+	}
+	for (i = 0; i < conn->count_encoders && kms->crtc_id == 0; i++) {
+		enc = drmModeGetEncoder(kms->fd, conn->encoders[i]);
+		if (enc == NULL)
+			continue;
+		for (j = 0; j < res->count_crtcs; j++) {
+			if (enc->possible_crtcs & (1 << j)) {
+				kms->crtc_id = res->crtcs[j];
+				break;
+			}
+		}
+		drmModeFreeEncoder(enc);
+	}
+	drmModeFreeConnector(conn);
+
+	for (i = 0; i < res->count_crtcs; i++)
+		if (res->crtcs[i] == kms->crtc_id)
+			break;
+	if (kms->crtc_id == 0 || i >= res->count_crtcs) {
+		fprintf(stderr, PFX "no usable crtc\n");
+		return -1;
+	}
+	kms->crtc_idx = i;
+
+	return 0;
+}
+
+struct vout_kms *vout_kms_init(const char *card_name, int *w, int *h, int bpp, int buffer_cnt)
+{
+	struct vout_kms *kms;
+	drmModeRes *res;
+	uint64_t has_dumb = 0;
+	int req_w, req_h;
+	void *pret;
+
+	kms = calloc(1, sizeof(*kms));
+	if (kms == NULL)
+		return NULL;
+
+	kms->buffer_pending = -1;
+
+	if (card_name == NULL)
+		card_name = "/dev/dri/card0";
+	kms->fd = open(card_name, O_RDWR | O_CLOEXEC);
+	if (kms->fd == -1) {
+		fprintf(stderr, PFX "%s: ", card_name);
+		perror("open");
+		goto fail_open;
+	}
+
+	if (drmGetCap(kms->fd, DRM_CAP_DUMB_BUFFER, &has_dumb) != 0 || !has_dumb) {
+		fprintf(stderr, PFX "%s: no dumb buffer support\n", card_name);
+		goto fail;
+	}
+
+	res = drmModeGetResources(kms->fd);
+	if (res == NULL) {
+		perror(PFX "drmModeGetResources");
+		goto fail;
+	}
+
+	if (kms_find_output(kms, res) != 0) {
+		drmModeFreeResources(res);
+		goto fail;
+	}
+
+	kms->atomic = kms_setup_atomic(kms) == 0;
+	drmModeFreeResources(res);
+
+	kms->crtc_old = drmModeGetCrtc(kms->fd, kms->crtc_id);
+
+	req_w = kms->mode.hdisplay;
+	if (*w != 0)
+		req_w = *w;
+	req_h = kms->mode.vdisplay;
+	if (*h != 0)
+		req_h = *h;
+
+	pret = vout_kms_resize(kms, req_w, req_h, bpp, 0, 0, 0, 0, buffer_cnt);
+	if (pret == NULL)
+		goto fail;
+
+	printf(PFX "%s: %ix%i@%d, %d buffers%s\n", card_name, kms->w, kms->h,
+		kms->bpp, kms->buffer_count, kms->atomic ? ", atomic" : "");
+	*w = kms->w;
+	*h = kms->h;
+
+	printf("kms initialized.\n");
+	return kms;
+
+fail:
+	if (kms->crtc_old != NULL)
+		drmModeFreeCrtc(kms->crtc_old);
+	close(kms->fd);
+fail_open:
+	free(kms);
+	return NULL;
+}
+
+void vout_kms_finish(struct vout_kms *kms)
+{
+	drmModeCrtc *c = kms->crtc_old;
+
+	kms_flip_sync(kms);
+	if (c != NULL) {
+		drmModeSetCrtc(kms->fd, c->crtc_id, c->buffer_id, c->x, c->y,
+			&kms->connector_id, 1, &c->mode);
+		drmModeFreeCrtc(c);
+	}
+	kms_free_buffers(kms);
+	if (kms->fd >= 0)
+		close(kms->fd);
+	kms->fd = -1;
+	free(kms);
+}
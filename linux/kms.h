@@ -0,0 +1,18 @@
+struct vout_kms;
+
+struct vout_kms *vout_kms_init(const char *card_name, int *w, int *h, int bpp, int buffer_count);
+void *vout_kms_flip(struct vout_kms *kms);
+void  vout_kms_wait_vsync(struct vout_kms *kms);
+/* w x h should be a mode of the connector; if there is none, the
+ * preferred mode is used and the image is centered in it, unscaled.
+ * The returned pointer is then inside a larger buffer, use
+ * vout_kms_get_pitch() */
+void *vout_kms_resize(struct vout_kms *kms, int w, int h, int bpp,
+		      int left_border, int right_border, int top_border, int bottom_border,
+		      int buffer_count);
+void  vout_kms_clear(struct vout_kms *kms);
+void  vout_kms_clear_lines(struct vout_kms *kms, int y, int count);
+int   vout_kms_get_fd(struct vout_kms *kms);
+/* bytes per line of the buffers returned by flip/resize */
+int   vout_kms_get_pitch(struct vout_kms *kms);
+void  vout_kms_finish(struct vout_kms *kms);
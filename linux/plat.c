@@ -19,7 +19,11 @@
 #include <unistd.h>
 #include <sys/mman.h>
 #include <errno.h>
+#include <poll.h>
+#include <stdint.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 #include "../plat.h"
 
@@ -139,28 +143,27 @@ void plat_sleep_ms(int ms)
 	usleep(ms * 1000);
 }
 
+/* one-off wait, starting where the last ready fd was
+ * so that a busy device can't starve the others */
 int plat_wait_event(int *fds_hnds, int count, int timeout_ms)
 {
-	struct timeval tv, *timeout = NULL;
-	int i, ret, fdmax = -1;
-	fd_set fdset;
-
-	if (timeout_ms >= 0) {
-		tv.tv_sec = timeout_ms / 1000;
-		tv.tv_usec = (timeout_ms % 1000) * 1000;
-		timeout = &tv;
-	}
+	static int next;
+	struct pollfd pfd[64];
+	int i, j, ret;
 
-	FD_ZERO(&fdset);
+	if (count > 64)
+		count = 64;
 	for (i = 0; i < count; i++) {
-		if (fds_hnds[i] > fdmax) fdmax = fds_hnds[i];
-		FD_SET(fds_hnds[i], &fdset);
+		pfd[i].fd = fds_hnds[i];
+		pfd[i].events = POLLIN;
 	}
 
-	ret = select(fdmax + 1, &fdset, NULL, NULL, timeout);
+	ret = poll(pfd, count, timeout_ms);
 	if (ret == -1)
 	{
-		perror("plat_wait_event: select failed");
+		if (errno == EINTR)
+			return -1;
+		perror("plat_wait_event: poll failed");
 		sleep(1);
 		return -1;
 	}
@@ -168,12 +171,114 @@ int plat_wait_event(int *fds_hnds, int count, int timeout_ms)
 	if (ret == 0)
 		return -1; /* timeout */
 
-	ret = -1;
-	for (i = 0; i < count; i++)
-		if (FD_ISSET(fds_hnds[i], &fdset))
-			ret = fds_hnds[i];
+	for (i = 0; i < count; i++) {
+		j = (next + i) % count;
+		if (pfd[j].revents) {
+			next = j + 1;
+			return fds_hnds[j];
+		}
+	}
 
-	return ret;
+	return -1;
+}
+
+/* persistent wait set, plus an eventfd for plat_wait_wakeup() */
+static int wait_epfd = -1;
+static int wait_evfd = -1;
+
+static int plat_wait_init(void)
+{
+	struct epoll_event ev;
+
+	if (wait_epfd >= 0)
+		return 0;
+
+	wait_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (wait_epfd < 0) {
+		perror("plat_wait: epoll_create1");
+		return -1;
+	}
+
+	wait_evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wait_evfd < 0)
+		perror("plat_wait: eventfd");
+	else {
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = wait_evfd;
+		epoll_ctl(wait_epfd, EPOLL_CTL_ADD, wait_evfd, &ev);
+	}
+
+	return 0;
+}
+
+int plat_wait_add(int fd_hnd)
+{
+	struct epoll_event ev;
+
+	if (plat_wait_init() != 0)
+		return -1;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd_hnd;
+	if (epoll_ctl(wait_epfd, EPOLL_CTL_ADD, fd_hnd, &ev) != 0 && errno != EEXIST) {
+		perror("plat_wait_add: epoll_ctl");
+		return -1;
+	}
+
+	return 0;
+}
+
+void plat_wait_remove(int fd_hnd)
+{
+	struct epoll_event ev;
+
+	if (wait_epfd < 0)
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	epoll_ctl(wait_epfd, EPOLL_CTL_DEL, fd_hnd, &ev);
+}
+
+int plat_wait_events(int *ready, int max, int timeout_ms)
+{
+	struct epoll_event evs[16];
+	uint64_t val;
+	int i, n, count = 0;
+
+	if (plat_wait_init() != 0)
+		return -1;
+
+	if (max > 16)
+		max = 16;
+	n = epoll_wait(wait_epfd, evs, max, timeout_ms);
+	if (n < 0) {
+		if (errno == EINTR)
+			return 0;
+		perror("plat_wait_events: epoll_wait");
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (evs[i].data.fd == wait_evfd) {
+			// just a wakeup, consume it
+			if (read(wait_evfd, &val, sizeof(val)) < 0)
+				;
+			continue;
+		}
+		ready[count++] = evs[i].data.fd;
+	}
+
+	return count;
+}
+
+void plat_wait_wakeup(void)
+{
+	uint64_t one = 1;
+
+	if (wait_evfd >= 0 && write(wait_evfd, &one, sizeof(one)) < 0)
+		; // counter full, a wakeup is pending anyway
 }
 
 void *plat_mmap(unsigned long addr, size_t size, int need_exec, int is_fixed)
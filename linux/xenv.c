@@ -410,6 +410,15 @@ int xenv_update(int (*key_cb)(void *cb_arg, int kc, int is_pressed),
 	return -1;
 }
 
+int xenv_get_fd(void)
+{
+	// xenv_update() leaves nothing queued in Xlib
+	if (g_xstuff.display)
+		return ConnectionNumber(g_xstuff.display);
+
+	return -1;
+}
+
 /* blocking minimize until user maximizes again */
 int xenv_minimize(void)
 {
@@ -15,6 +15,10 @@ int  xenv_update(int (*key_cb)(void *cb_arg, int kc, int is_pressed),
 		 int (*mousem_cb)(void *cb_arg, int x, int y),
 		 void *cb_arg);
 
+/* fd that becomes readable when xenv_update() has events,
+ * for in_drv_t.get_wait_hnd; -1 if there is none */
+int  xenv_get_fd(void);
+
 int  xenv_minimize(void);
 void xenv_finish(void);
 
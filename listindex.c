@@ -0,0 +1,341 @@
+/*
+ * search index for menu lists
+ *
+ * This work is licensed under the terms of any of these licenses
+ * (at your option):
+ *  - GNU GPL, version 2 or later.
+ *  - GNU LGPL, version 2.1 or later.
+ *  - MAME license.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "listindex.h"
+
+#define LI_TRI_BITS 12
+#define LI_TRI_BUCKETS (1 << LI_TRI_BITS)
+
+struct li_word {
+	unsigned int pos;	// into blob
+	unsigned int item;
+};
+
+struct listindex {
+	int count;
+	char *blob;		// folded names, \0 terminated
+	struct li_word *words;	// sorted by folded text from pos on
+	int word_count;
+	unsigned int *seen;	// per item, for deduplication
+	unsigned int stamp;
+
+	// trigram postings, built on the first fuzzy query
+	unsigned int *tri_start;
+	unsigned int *tri_items;
+	unsigned short *tri_hits;
+};
+
+// U+00C0..U+00FF without diacritics
+static const char latin1_fold[64 + 1] =
+	"aaaaaaaceeeeiiiidnooooo*ouuuuyts"
+	"aaaaaaaceeeeiiiidnooooo/ouuuuyty";
+
+static unsigned int utf8_get(const unsigned char **p, int *len)
+{
+	const unsigned char *s = *p;
+	unsigned int c = s[0];
+
+	*len = 1;
+	if (c >= 0xe0 && c < 0xf0 && (s[1] & 0xc0) == 0x80 && (s[2] & 0xc0) == 0x80) {
+		c = ((c & 0x0f) << 12) | ((s[1] & 0x3f) << 6) | (s[2] & 0x3f);
+		*len = 3;
+	}
+	else if (c >= 0xc0 && c < 0xe0 && (s[1] & 0xc0) == 0x80) {
+		c = ((c & 0x1f) << 6) | (s[1] & 0x3f);
+		*len = 2;
+	}
+	*p = s + *len;
+	return c;
+}
+
+/* fold case/accents/width, returns length */
+static int fold(const char *src, char *dst, int size)
+{
+	const unsigned char *p = (const unsigned char *)src;
+	const unsigned char *start;
+	unsigned int c;
+	int o = 0, len;
+
+	while (*p != 0 && o < size - 4) {
+		start = p;
+		c = utf8_get(&p, &len);
+		if (0xff01 <= c && c <= 0xff5e)
+			c -= 0xfee0; // full-width ASCII
+		else if (c == 0x3000)
+			c = ' ';
+		else if (0xc0 <= c && c <= 0xff)
+			c = latin1_fold[c - 0xc0];
+
+		if (c < 0x80) {
+			if ('A' <= c && c <= 'Z')
+				c += 'a' - 'A';
+			dst[o++] = c;
+		}
+		else {
+			memcpy(dst + o, start, len);
+			o += len;
+		}
+	}
+	dst[o] = 0;
+
+	return o;
+}
+
+static int is_separator(char c)
+{
+	return c == ' ' || c == '_' || c == '-' || c == '.' || c == ','
+		|| c == '(' || c == ')' || c == '[' || c == ']';
+}
+
+static const char *li_sort_blob;
+
+static int li_word_cmp(const void *p1, const void *p2)
+{
+	const struct li_word *w1 = p1, *w2 = p2;
+	int r = strcmp(li_sort_blob + w1->pos, li_sort_blob + w2->pos);
+	return r != 0 ? r : (int)w1->item - (int)w2->item;
+}
+
+static int int_cmp(const void *p1, const void *p2)
+{
+	return *(const int *)p1 - *(const int *)p2;
+}
+
+struct listindex *listindex_new(const char * const *names, int count)
+{
+	struct listindex *li;
+	size_t blob_size = 0, pos;
+	int i, len, pass, words = 0;
+	unsigned char c;
+
+	li = calloc(1, sizeof(*li));
+	if (li == NULL)
+		goto oom;
+	li->count = count;
+
+	// folding never makes a name longer
+	for (i = 0; i < count; i++)
+		blob_size += strlen(names[i]) + 1;
+	li->blob = malloc(blob_size + 4);
+	li->seen = calloc(count + 1, sizeof(li->seen[0]));
+	if (li->blob == NULL || li->seen == NULL)
+		goto oom;
+
+	for (i = 0, pos = 0; i < count; i++)
+		pos += fold(names[i], li->blob + pos, blob_size + 4 - pos) + 1;
+
+	// word starts: name start, after separators and each CJK char
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0, pos = 0; i < count; i++) {
+			for (len = 0; li->blob[pos + len] != 0; len++) {
+				c = li->blob[pos + len];
+				if (len != 0 && c < 0xe0
+				    && (!is_separator(li->blob[pos + len - 1]) || is_separator(c)))
+					continue;
+				if (pass == 1) {
+					li->words[words].pos = pos + len;
+					li->words[words].item = i;
+				}
+				words++;
+			}
+			pos += len + 1;
+		}
+
+		if (pass == 0) {
+			li->word_count = words;
+			li->words = malloc((words + 1) * sizeof(li->words[0]));
+			if (li->words == NULL)
+				goto oom;
+			words = 0;
+		}
+	}
+
+	li_sort_blob = li->blob;
+	qsort(li->words, li->word_count, sizeof(li->words[0]), li_word_cmp);
+
+	return li;
+
+oom:
+	fprintf(stderr, "listindex: OOM\n");
+	listindex_free(li);
+	return NULL;
+}
+
+static unsigned int tri_hash(const unsigned char *s)
+{
+	unsigned int v = (s[0] << 16) | (s[1] << 8) | s[2];
+	return (v * 2654435761u) >> (32 - LI_TRI_BITS);
+}
+
+static int li_build_trigrams(struct listindex *li)
+{
+	unsigned int *last;
+	const unsigned char *s;
+	unsigned int b, total = 0;
+	size_t pos;
+	int i, pass;
+
+	li->tri_start = calloc(LI_TRI_BUCKETS + 1, sizeof(li->tri_start[0]));
+	li->tri_hits = calloc(li->count + 1, sizeof(li->tri_hits[0]));
+	last = malloc(LI_TRI_BUCKETS * sizeof(last[0]));
+	if (li->tri_start == NULL || li->tri_hits == NULL || last == NULL)
+		goto fail;
+
+	// count, then fill; each item is listed once per bucket
+	for (pass = 0; pass < 2; pass++) {
+		memset(last, 0xff, LI_TRI_BUCKETS * sizeof(last[0]));
+		for (i = 0, pos = 0; i < li->count; i++) {
+			s = (unsigned char *)li->blob + pos;
+			for (; s[0] && s[1] && s[2]; s++) {
+				b = tri_hash(s);
+				if (last[b] == (unsigned int)i)
+					continue;
+				last[b] = i;
+				if (pass == 0)
+					li->tri_start[b + 1]++;
+				else
+					li->tri_items[li->tri_start[b]++] = i;
+			}
+			pos += strlen(li->blob + pos) + 1;
+		}
+
+		if (pass == 0) {
+			for (b = 0; b < LI_TRI_BUCKETS; b++)
+				li->tri_start[b + 1] += li->tri_start[b];
+			total = li->tri_start[LI_TRI_BUCKETS];
+			li->tri_items = malloc((total + 1) * sizeof(li->tri_items[0]));
+			if (li->tri_items == NULL)
+				goto fail;
+		}
+	}
+	// filling advanced each start to the next bucket's
+	memmove(li->tri_start + 1, li->tri_start, LI_TRI_BUCKETS * sizeof(li->tri_start[0]));
+	li->tri_start[0] = 0;
+
+	free(last);
+	return 0;
+
+fail:
+	fprintf(stderr, "listindex: OOM\n");
+	free(last);
+	free(li->tri_start);
+	free(li->tri_items);
+	free(li->tri_hits);
+	li->tri_start = NULL;
+	li->tri_items = NULL;
+	li->tri_hits = NULL;
+	return -1;
+}
+
+static int li_match_fuzzy(struct listindex *li, const char *q, int *out)
+{
+	unsigned int buckets[256], b;
+	int i, j, qt = 0, touched = 0, need, k;
+	const unsigned char *s;
+
+	if (li->tri_start == NULL && li_build_trigrams(li) != 0)
+		return 0;
+
+	for (s = (const unsigned char *)q; s[0] && s[1] && s[2] && qt < 256; s++) {
+		b = tri_hash(s);
+		for (j = 0; j < qt; j++)
+			if (buckets[j] == b)
+				break;
+		if (j == qt)
+			buckets[qt++] = b;
+	}
+	if (qt == 0)
+		return 0;
+
+	// out[] doubles as the list of items seen
+	for (j = 0; j < qt; j++) {
+		for (i = li->tri_start[buckets[j]]; i < (int)li->tri_start[buckets[j] + 1]; i++) {
+			unsigned int item = li->tri_items[i];
+			if (li->tri_hits[item]++ == 0)
+				out[touched++] = item;
+		}
+	}
+
+	// a typo spoils up to 3 trigrams, so half is good enough
+	need = (qt + 1) / 2;
+	for (i = k = 0; i < touched; i++) {
+		if (li->tri_hits[out[i]] >= need)
+			out[k++] = out[i];
+		li->tri_hits[out[i]] = 0;
+	}
+
+	return k;
+}
+
+int listindex_match(struct listindex *li, const char *query, int fuzzy, int *out)
+{
+	char q[256];
+	int qlen, lo, hi, mid, i, k = 0;
+	unsigned int item;
+
+	if (li == NULL)
+		return 0;
+
+	qlen = fold(query, q, sizeof(q));
+	if (qlen == 0) {
+		for (i = 0; i < li->count; i++)
+			out[i] = i;
+		return li->count;
+	}
+
+	// first word >= query
+	lo = 0;
+	hi = li->word_count;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (strncmp(li->blob + li->words[mid].pos, q, qlen) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (++li->stamp == 0) {
+		memset(li->seen, 0, li->count * sizeof(li->seen[0]));
+		li->stamp = 1;
+	}
+	for (i = lo; i < li->word_count; i++) {
+		if (strncmp(li->blob + li->words[i].pos, q, qlen) != 0)
+			break;
+		item = li->words[i].item;
+		if (li->seen[item] != li->stamp) {
+			li->seen[item] = li->stamp;
+			out[k++] = item;
+		}
+	}
+
+	if (k == 0 && fuzzy && qlen >= 3)
+		k = li_match_fuzzy(li, q, out);
+
+	qsort(out, k, sizeof(out[0]), int_cmp);
+	return k;
+}
+
+void listindex_free(struct listindex *li)
+{
+	if (li == NULL)
+		return;
+	free(li->blob);
+	free(li->words);
+	free(li->seen);
+	free(li->tri_start);
+	free(li->tri_items);
+	free(li->tri_hits);
+	free(li);
+}
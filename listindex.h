@@ -0,0 +1,20 @@
+#ifndef LIBPICOFE_LISTINDEX_H
+#define LIBPICOFE_LISTINDEX_H
+
+struct listindex;
+
+/* Search index over a list of UTF-8 names. Names are folded (case,
+ * Latin-1 accents, full-width ASCII) and every word start is kept in a
+ * sorted array, so a query matches any word prefix with a binary search.
+ * names[] is only read during listindex_new(). */
+struct listindex *listindex_new(const char * const *names, int count);
+void listindex_free(struct listindex *li);
+
+/* Writes indices of matching names, in list order, to out[] (room for
+ * count entries needed), returns how many. If nothing matches and
+ * 'fuzzy' is set, names sharing most trigrams with the query are
+ * returned instead. */
+int  listindex_match(struct listindex *li, const char *query, int fuzzy,
+		int *out);
+
+#endif // LIBPICOFE_LISTINDEX_H
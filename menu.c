@@ -15,6 +15,7 @@
 #include <stdarg.h>
 #include <time.h>
 #include <locale.h> // savestate date
+#include <pthread.h>
 #include <SDL/SDL.h>
 #include <SDL/SDL_ttf.h>
 
@@ -25,6 +26,12 @@
 #include "input.h"
 #include "plat.h"
 #include "posix.h"
+#include "fastmem.h"
+#include "fontcache.h"
+#include "dirscan.h"
+#include "dircache.h"
+#include "listindex.h"
+#include "skincache.h"
 #include "core.h"
 
 #if defined(__GNUC__) && __GNUC__ >= 7
@@ -47,6 +54,7 @@ void *g_menubg_src_ptr;
 int g_menuscreen_w;
 int g_menuscreen_h;
 int g_menuscreen_pp;
+int g_menuscreen_bpp = 16; // of the surface and g_menubg_ptr, 16 (RGB565) or 32 (XRGB8888)
 int g_menubg_src_w;
 int g_menubg_src_h;
 int g_menubg_src_pp;
@@ -55,6 +63,12 @@ int g_autostateld_opt;
 
 static TTF_Font *me_mfont = NULL;
 static TTF_Font *me_sfont = NULL;
+static struct fontcache *me_mfont_cache;
+static struct fontcache *me_sfont_cache;
+static struct skincache *me_skincache;
+// me_draw() name column width, -1 after a font (re)load
+static int me_col_w = -1;
+static unsigned int me_col_key;
 static int menu_text_color = 0xfffe; // default to white
 static int menu_sel_color = -1;		 // disabled
 
@@ -71,17 +85,68 @@ static const int me_mfont_w = 12, me_mfont_h = 14;
 static const int me_sfont_w = 10, me_sfont_h = 12;
 #endif
 
+// glyphs kept rasterized per font, enough for a screen full of CJK
+#define MENU_GLYPH_CACHE 512
+
 static int g_menu_filter_off;
 static int g_border_style;
 static int border_left, border_right, border_top, border_bottom;
 
+#define MENU_BYPP (g_menuscreen_bpp / 8)
+
+/* menu colors are given as RGB565, this gives the surface's format */
+static unsigned int menu_color(unsigned int c)
+{
+	unsigned int r, g, b;
+
+	if (g_menuscreen_bpp != 32)
+		return c;
+	r = (c >> 11) & 0x1f;
+	g = (c >> 5) & 0x3f;
+	b = c & 0x1f;
+	return ((r << 3 | r >> 2) << 16) | ((g << 2 | g >> 4) << 8) | (b << 3 | b >> 2);
+}
+
+static void *menu_line(int y)
+{
+	return (char *)g_menuscreen_surface->pixels + y * g_menuscreen_pp * MENU_BYPP;
+}
+
 void menuscreen_memset_lines(unsigned short *dst, int c, int l)
 {
-	for (; l > 0; l--, dst += g_menuscreen_pp)
-		memset(dst, c, g_menuscreen_w * 2);
+	char *d = (char *)dst;
+
+	// memset semantics, c is a byte value
+	c &= 0xff;
+	if (g_menuscreen_bpp == 32)
+	{
+		for (; l > 0; l--, d += g_menuscreen_pp * 4)
+			fastmem_fill32(d, c * 0x01010101u, g_menuscreen_w);
+		return;
+	}
+	fastmem_fill16_lines(dst, c | (c << 8), g_menuscreen_w, l, g_menuscreen_pp * 2);
+}
+
+static int menu_font_draw(struct fontcache *fc, int x, int y, unsigned short color,
+						  const char *text, int *text_h)
+{
+	int text_w;
+
+	SDL_LockSurface(g_menuscreen_surface);
+	if (g_menuscreen_bpp == 32)
+		text_w = fontcache_draw32(fc, g_menuscreen_surface->pixels,
+			g_menuscreen_w, g_menuscreen_h, g_menuscreen_surface->pitch,
+			x, y, menu_color(color), text, text_h);
+	else
+		text_w = fontcache_draw16(fc, g_menuscreen_surface->pixels,
+			g_menuscreen_w, g_menuscreen_h, g_menuscreen_surface->pitch,
+			x, y, color, text, text_h);
+	SDL_UnlockSurface(g_menuscreen_surface);
+
+	return text_w;
 }
 
-// draws text to current bbp16 screen
+// draws text to the menu screen
 static int text_out16_(int x, int y, unsigned short color, const char *text)
 {
 	if (!text || x < 0 || x >= g_menuscreen_w ||
@@ -89,16 +154,7 @@ static int text_out16_(int x, int y, unsigned short color, const char *text)
 		return 0;
 
 	int text_w = 0, text_h = 0;
-	SDL_Color text_color = {(color & 0xf800) >> 8, (color & 0x07e0) >> 3, (color & 0x001f) << 3};
-	SDL_Surface *text_surface = TTF_RenderUTF8_Blended(me_mfont, text, text_color);
-	if (text_surface)
-	{
-		text_w = text_surface->w;
-		text_h = text_surface->h;
-		SDL_Rect text_pos = {x, y, text_surface->w, text_surface->h};
-		SDL_BlitSurface(text_surface, NULL, g_menuscreen_surface, &text_pos);
-		SDL_FreeSurface(text_surface);
-	}
+	text_w = menu_font_draw(me_mfont_cache, x, y, color, text, &text_h);
 
 	if (x < border_left)
 		border_left = x;
@@ -130,17 +186,7 @@ static int smalltext_out16_(int x, int y, unsigned short color, const char *text
 		y < 0 || y >= g_menuscreen_h)
 		return 0;
 
-	int text_w = 0;
-	SDL_Color text_color = {(color & 0xf800) >> 8, (color & 0x07e0) >> 3, (color & 0x001f) << 3};
-	SDL_Surface *text_surface = TTF_RenderUTF8_Blended(me_sfont, text, text_color);
-	if (text_surface)
-	{
-		text_w = text_surface->w;
-		SDL_Rect text_pos = {x, y, text_surface->w, text_surface->h};
-		SDL_BlitSurface(text_surface, NULL, g_menuscreen_surface, &text_pos);
-		SDL_FreeSurface(text_surface);
-	}
-	return text_w;
+	return menu_font_draw(me_sfont_cache, x, y, color, text, NULL);
 }
 
 static int smalltext_out16(int x, int y, unsigned short color, const char *textf, ...)
@@ -181,30 +227,98 @@ static char tolower_simple(char c)
 	return c;
 }
 
+/* from the skin cache if it has the glyphs, opening the font only
+ * when a glyph is missing; else rasterize ASCII and cache that */
+static void menu_load_font(TTF_Font **font, struct fontcache **fc,
+	const char *path, int size)
+{
+	const void *data;
+	size_t data_size;
+	char name[16], ascii[0x7f - 0x20 + 1];
+	void *blob;
+	int i;
+
+	fontcache_free(*fc);
+	*fc = NULL;
+	if (*font != NULL)
+		TTF_CloseFont(*font);
+	*font = NULL;
+
+	snprintf(name, sizeof(name), "font%d", size);
+	data = skincache_get(me_skincache, name, path, &data_size);
+	if (data != NULL) {
+		*fc = fontcache_load(data, data_size, path, size, MENU_GLYPH_CACHE);
+		if (*fc != NULL)
+			return;
+	}
+
+	*font = TTF_OpenFont(path, size);
+	if (*font == NULL) {
+		printf("ERROR in menu_init_base: Could not open menu font %s, %s\n", path, SDL_GetError());
+		return;
+	}
+	*fc = fontcache_new(*font, MENU_GLYPH_CACHE);
+	if (*fc == NULL)
+		return;
+
+	for (i = 0; i < (int)sizeof(ascii) - 1; i++)
+		ascii[i] = 0x20 + i;
+	ascii[i] = 0;
+	fontcache_text_width(*fc, ascii);
+	blob = fontcache_save(*fc, &data_size);
+	if (blob != NULL) {
+		skincache_put(me_skincache, name, path, blob, data_size);
+		free(blob);
+	}
+}
+
+static void menu_save_font(struct fontcache *fc, const char *path, int size)
+{
+	size_t data_size;
+	char name[16];
+	void *blob;
+
+	if (fontcache_rasterized(fc) == 0)
+		return;
+	blob = fontcache_save(fc, &data_size);
+	if (blob == NULL)
+		return;
+	snprintf(name, sizeof(name), "font%d", size);
+	skincache_put(me_skincache, name, path, blob, data_size);
+	free(blob);
+}
+
 void menu_init_base(void)
 {
+	struct { int text, sel; } colors;
+	const void *cached;
+	size_t cached_size;
 	int pos;
 	char buff[256];
 	FILE *f;
 
 	pos = plat_get_skin_dir(buff, sizeof(buff));
-	strcpy(buff + pos, "font.ttf");
+	buff[pos] = 0;
+	skincache_close(me_skincache);
+	me_skincache = skincache_open(buff);
 
-	if (me_mfont != NULL)
-		TTF_CloseFont(me_mfont);
-	me_mfont = TTF_OpenFont(buff, me_mfont_size);
-	if (me_mfont == NULL)
-		printf("ERROR in menu_init_base: Could not open menu font %s, %s\n", buff, SDL_GetError());
-
-	if (me_sfont != NULL)
-		TTF_CloseFont(me_sfont);
-	me_sfont = TTF_OpenFont(buff, me_sfont_size);
-	if (me_sfont == NULL)
-		printf("ERROR in menu_init_base: Could not open menu font %s, %s\n", buff, SDL_GetError());
+	strcpy(buff + pos, "font.ttf");
+	menu_load_font(&me_mfont, &me_mfont_cache, buff, me_mfont_size);
+	menu_load_font(&me_sfont, &me_sfont_cache, buff, me_sfont_size);
+	me_col_w = -1;
 
 	// load custom colors
 	strcpy(buff + pos, "skin.txt");
-	f = fopen(buff, "r");
+	cached = skincache_get(me_skincache, "colors", buff, &cached_size);
+	if (cached != NULL && cached_size == sizeof(colors))
+	{
+		memcpy(&colors, cached, sizeof(colors));
+		menu_text_color = colors.text;
+		menu_sel_color = colors.sel;
+		f = NULL;
+	}
+	else
+		f = fopen(buff, "r");
 	if (f != NULL)
 	{
 		lprintf("found skin.txt\n");
@@ -236,39 +350,131 @@ void menu_init_base(void)
 				lprintf("skin.txt: parse error: %s\n", buff);
 		}
 		fclose(f);
+
+		colors.text = menu_text_color;
+		colors.sel = menu_sel_color;
+		strcpy(buff + pos, "skin.txt");
+		skincache_put(me_skincache, "colors", buff, &colors, sizeof(colors));
 	}
+	skincache_commit(me_skincache);
 
 	// use user's locale for savestate date display
 	setlocale(LC_TIME, "");
 }
 
-static void menu_darken_bg(void *dst, void *src, int pixels, int darker)
+/* darkened copy of g_menubg_ptr, made once per menu screen */
+static void *menubg_dark;
+static int menubg_dark_w, menubg_dark_h;
+static int menubg_dark_valid;
+
+/* the frontend changed g_menubg_ptr */
+static void menu_bg_changed(void)
+{
+	menubg_dark_valid = 0;
+}
+
+static const void *menu_bg_dark(void)
 {
-	unsigned int *dest = dst;
-	unsigned int *sorc = src;
-	pixels /= 2;
-	if (darker)
+	size_t size = g_menuscreen_w * g_menuscreen_h;
+
+	if (menubg_dark_valid && menubg_dark_w == g_menuscreen_w
+		&& menubg_dark_h == g_menuscreen_h)
+		return menubg_dark;
+
+	if (menubg_dark == NULL || menubg_dark_w * menubg_dark_h < (int)size)
 	{
-		while (pixels--)
-		{
-			unsigned int p = *sorc++;
-			*dest++ = ((p & 0xf79ef79e) >> 1) - ((p & 0xc618c618) >> 3);
-		}
+		free(menubg_dark);
+		menubg_dark = malloc(size * 4);
+		if (menubg_dark == NULL)
+			return NULL;
 	}
+	if (g_menuscreen_bpp == 32)
+		fastmem_darken32(menubg_dark, g_menubg_ptr, size, 1);
 	else
-	{
-		while (pixels--)
-		{
-			unsigned int p = *sorc++;
-			*dest++ = (p & 0xf79ef79e) >> 1;
+		fastmem_darken16(menubg_dark, g_menubg_ptr, size, 1);
+	menubg_dark_w = g_menuscreen_w;
+	menubg_dark_h = g_menuscreen_h;
+	menubg_dark_valid = 1;
+
+	return menubg_dark;
+}
+
+int menu_load_bg(const char *fname)
+{
+	size_t size = g_menuscreen_w * g_menuscreen_h * MENU_BYPP, cached_size;
+	const void *cached;
+	char name[64];
+	int ret;
+
+	snprintf(name, sizeof(name), "bg%dx%dx%d_%016llx", g_menuscreen_w,
+		g_menuscreen_h, g_menuscreen_bpp, fastmem_hash(fname, strlen(fname)));
+	cached = skincache_get(me_skincache, name, fname, &cached_size);
+	if (cached != NULL && cached_size == size) {
+		memcpy(g_menubg_ptr, cached, size);
+		ret = 0;
+	}
+	else {
+		ret = readpng(g_menubg_ptr, fname,
+			g_menuscreen_bpp == 32 ? READPNG_BG32 : READPNG_BG,
+			g_menuscreen_w, g_menuscreen_h);
+		if (ret == 0) {
+			skincache_put(me_skincache, name, fname, g_menubg_ptr, size);
+			skincache_commit(me_skincache);
 		}
 	}
+	menu_bg_changed();
+
+	return ret;
+}
+
+void menu_save_skin_cache(void)
+{
+	char buff[256];
+	int pos;
+
+	pos = plat_get_skin_dir(buff, sizeof(buff));
+	strcpy(buff + pos, "font.ttf");
+	menu_save_font(me_mfont_cache, buff, me_mfont_size);
+	menu_save_font(me_sfont_cache, buff, me_sfont_size);
+	skincache_commit(me_skincache);
+}
+
+/* restore background lines y..y+h-1 */
+static void menu_restore_bg(const void *bg_, int y, int h)
+{
+	const char *bg = (const char *)bg_ + g_menuscreen_w * MENU_BYPP * y;
+	char *dst = menu_line(y);
+	int len = g_menuscreen_w * MENU_BYPP;
+
+	if (g_menuscreen_pp == g_menuscreen_w)
+	{
+		memcpy(dst, bg, len * h);
+		return;
+	}
+	for (; h > 0; h--, dst += g_menuscreen_pp * MENU_BYPP, bg += len)
+		memcpy(dst, bg, len);
+}
+
+/* in place, for highlights */
+static void menu_darken_lines(int y, int h)
+{
+	if (g_menuscreen_bpp == 32)
+		fastmem_darken32(menu_line(y), menu_line(y), g_menuscreen_pp * h, 1);
+	else
+		fastmem_darken16(menu_line(y), menu_line(y), g_menuscreen_pp * h, 1);
+}
+
+static void menu_put_pixels(int x, int y, int w, unsigned short color)
+{
+	if (g_menuscreen_bpp == 32)
+		fastmem_fill32((unsigned int *)menu_line(y) + x, menu_color(color), w);
+	else
+		fastmem_fill16((unsigned short *)menu_line(y) + x, color, w);
 }
 
 static void menu_darken_text_bg(void)
 {
-	int x, y, xmin, xmax, ymax, ls;
-	unsigned short *screen = g_menuscreen_surface->pixels;
+	int y, xmin, xmax, ymax;
 
 	SDL_LockSurface(g_menuscreen_surface);
 
@@ -286,29 +492,30 @@ static void menu_darken_text_bg(void)
 	if (ymax > g_menuscreen_h - 1)
 		ymax = g_menuscreen_h - 1;
 
-	for (x = xmin; x <= xmax; x++)
-		screen[y * g_menuscreen_pp + x] = 0xa514;
+	menu_put_pixels(xmin, y, xmax - xmin + 1, 0xa514);
 	for (y++; y < ymax; y++)
 	{
-		ls = y * g_menuscreen_pp;
-		screen[ls + xmin] = 0xffff;
-		for (x = xmin + 1; x < xmax; x++)
-		{
-			unsigned int p = screen[ls + x];
-			if (p != menu_text_color)
-				screen[ls + x] = ((p & 0xf79e) >> 1) - ((p & 0xc618) >> 3);
-		}
-		screen[ls + xmax] = 0xffff;
+		menu_put_pixels(xmin, y, 1, 0xffff);
+		if (g_menuscreen_bpp == 32)
+			fastmem_darken32_except((unsigned int *)menu_line(y) + xmin + 1,
+									xmax - xmin - 1, menu_color(menu_text_color));
+		else
+			fastmem_darken16_except((unsigned short *)menu_line(y) + xmin + 1,
+									xmax - xmin - 1, menu_text_color);
+		menu_put_pixels(xmax, y, 1, 0xffff);
 	}
-	ls = y * g_menuscreen_pp;
-	for (x = xmin; x <= xmax; x++)
-		screen[ls + x] = 0xffff;
+	menu_put_pixels(xmin, y, xmax - xmin + 1, 0xffff);
 
 	SDL_UnlockSurface(g_menuscreen_surface);
 }
 
 static int borders_pending;
 
+/* what the menu loops have to redraw before waiting for input again */
+#define MENU_REDRAW_ALL (1 << 0)
+#define MENU_REDRAW_MSG (1 << 1) // help/message lines only
+static char menu_drawn_msg[64];
+
 static void menu_reset_borders(void)
 {
 	border_left = g_menuscreen_w;
@@ -319,34 +526,50 @@ static void menu_reset_borders(void)
 
 static void menu_draw_begin(int need_bg, int no_borders)
 {
-	int y;
+	const void *bg;
 
 	plat_video_menu_begin();
+	fontcache_frame(me_mfont_cache);
+	fontcache_frame(me_sfont_cache);
 
 	menu_reset_borders();
 	borders_pending = g_border_style && !no_borders;
 
 	if (need_bg)
 	{
-		SDL_LockSurface(g_menuscreen_surface);
-
-		if (g_border_style && no_borders)
-		{
-			for (y = 0; y < g_menuscreen_h; y++)
-				menu_darken_bg((short *)g_menuscreen_surface->pixels + g_menuscreen_pp * y,
-							   (short *)g_menubg_ptr + g_menuscreen_w * y, g_menuscreen_w, 1);
-		}
-		else
-		{
-			for (y = 0; y < g_menuscreen_h; y++)
-				memcpy((short *)g_menuscreen_surface->pixels + g_menuscreen_pp * y,
-					   (short *)g_menubg_ptr + g_menuscreen_w * y, g_menuscreen_w * 2);
-		}
+		bg = g_menubg_ptr;
+		if (g_border_style && no_borders && menu_bg_dark() != NULL)
+			bg = menubg_dark;
 
+		SDL_LockSurface(g_menuscreen_surface);
+		menu_restore_bg(bg, 0, g_menuscreen_h);
 		SDL_UnlockSurface(g_menuscreen_surface);
 	}
 }
 
+/* Redraw only lines y..y+h-1 on top of the previous frame.
+ * Not possible with text borders as those enclose all text. */
+static int menu_draw_begin_lines(int y, int h)
+{
+	if (g_border_style)
+		return 0;
+
+	plat_video_menu_begin();
+	fontcache_frame(me_mfont_cache);
+	fontcache_frame(me_sfont_cache);
+
+	menu_reset_borders();
+	borders_pending = 0;
+
+	if (y + h > g_menuscreen_h)
+		h = g_menuscreen_h - y;
+	SDL_LockSurface(g_menuscreen_surface);
+	menu_restore_bg(g_menubg_ptr, y, h);
+	SDL_UnlockSurface(g_menuscreen_surface);
+
+	return 1;
+}
+
 static void menu_draw_end(void)
 {
 	if (borders_pending)
@@ -414,111 +637,192 @@ static void me_toggle_onoff(menu_entry *ent)
 		*(unsigned char *)ent->var ^= ent->mask;
 }
 
+/* Scrolling list shared by the menus: which items are visible and where.
+ * Only rows top..end-1 need drawing. */
+struct menu_list
+{
+	int y;		// first row
+	int rows;	// rows that fit
+	int count;
+	int top;	// first visible item
+	int end;
+};
+
+static void menu_list_layout(struct menu_list *l, int y, int h, int count, int sel)
+{
+	l->y = y;
+	l->rows = h / me_mfont_h;
+	l->count = count;
+
+	// keep the selection centered
+	l->top = sel - l->rows / 2;
+	if (l->top > count - l->rows)
+		l->top = count - l->rows;
+	if (l->top < 0)
+		l->top = 0;
+	l->end = l->top + l->rows;
+	if (l->end > count)
+		l->end = count;
+}
+
+static int menu_list_row_y(const struct menu_list *l, int i)
+{
+	return l->y + (i - l->top) * me_mfont_h;
+}
+
+/* draws the selection marker, returns x for the item text */
+static int menu_list_draw_sel(const struct menu_list *l, int sel)
+{
+	int x = 5;
+
+	return x + menu_draw_selection(x, menu_list_row_y(l, sel)) + 5;
+}
+
+// bottom 3 small font lines, for help and error messages
+#define ME_MSG_LINES 3
+
+static void me_draw_msg(const menu_entry *ent)
+{
+	int msg_x = 5, msg_sy = g_menuscreen_h - me_sfont_h * ME_MSG_LINES;
+	int y;
+
+	snprintf(menu_drawn_msg, sizeof(menu_drawn_msg), "%s", menu_error_msg);
+
+	if (menu_error_msg[0] != 0)
+	{
+		smalltext_out16(msg_x, msg_sy, menu_sel_color, menu_error_msg);
+
+		if (plat_get_ticks_ms() - menu_error_time > 2048)
+			menu_error_msg[0] = 0;
+	}
+	else if (ent->help != NULL)
+	{
+		int len = strlen(ent->help);
+		int i, l = 1;
+		for (i = 0; i < len; i++)
+		{
+			if (ent->help[i] == '\n')
+				l++;
+		}
+		if (l <= ME_MSG_LINES)
+		{
+			y = msg_sy + me_sfont_h * (ME_MSG_LINES - l);
+
+			char *buf = malloc(len + 1);
+			strcpy(buf, ent->help);
+			char *p = buf;
+			char *p2;
+			for (i = 0; i < l; i++)
+			{
+				p2 = strchr(p, '\n');
+				if (p2)
+					*p2++ = '\0';
+				smalltext_out16(msg_x, y, 0xffff, p);
+				p = p2;
+				y += me_sfont_h;
+			}
+			free(buf);
+		}
+		else
+		{
+			lprintf("menu msg doesn't fit!\n");
+		}
+	}
+}
+
+static const char *me_entry_name(const menu_entry *ent)
+{
+	if (ent->name[0] == 0 && ent->generate_name)
+		return ent->generate_name(ent->id);
+	return ent->name;
+}
+
+// hash of the enabled entry names, changes whenever the column width may
+static unsigned int me_col_names_key(const menu_entry *entries)
+{
+	const menu_entry *ent;
+	const char *p;
+	unsigned int h = 2166136261u;
+
+	for (ent = entries; ent->name; ent++)
+	{
+		if (!ent->enabled)
+			continue;
+		for (p = ent->name; *p; p++)
+			h = (h ^ (unsigned char)*p) * 16777619u;
+		h = (h ^ 0xff) * 16777619u;
+	}
+	return h;
+}
+
 static void me_draw(const char *title, menu_entry *entries, int sel, void (*draw_more)(void))
 {
+	unsigned int col_key;
+	struct menu_list list;
 	menu_entry *ent;
 	const char **names;
 	const char *name;
-	menu_entry **enable_entries = NULL;
-	int n_enable_entries;
-	int n_entries;
-	int m_sel;
-
+	int n_enabled, m_sel;
 	int wt;
 	int title_x, title_y;
-	int msg_x, msg_sy;
-	int sel_x, sel_y;
-	int listview_h;
-	int listview_x, listview_x2, listview_sy, listview_dy;
-	int n_draw_items, half_draw_items, top_idx;
-	int item_left_w = 0;
+	int msg_sy;
+	int listview_x, listview_x2, listview_sy;
 	int i, j, y;
 
 	menu_draw_begin(1, 0);
 
-	n_entries = me_count(entries);
-	enable_entries = calloc(n_entries, sizeof(menu_entry *));
-	if (!enable_entries)
-		goto finish;
-	n_enable_entries = 0;
-
-	// 获取enabled entries
-	for (i = 0; i < n_entries; i++)
+	n_enabled = m_sel = 0;
+	for (ent = entries; ent->name; ent++)
 	{
-		ent = entries + i;
-
-		if (sel == i)
-			m_sel = n_enable_entries;
-
+		if (ent == entries + sel)
+			m_sel = n_enabled;
 		if (ent->enabled)
-		{
-			enable_entries[n_enable_entries] = ent;
-			n_enable_entries++;
-		}
+			n_enabled++;
 	}
-	wt = 0;
-	TTF_SizeUTF8(me_mfont, title, &wt, NULL);
+
+	wt = fontcache_text_width(me_mfont_cache, title);
 	title_x = (g_menuscreen_w - wt) / 2;
 	title_y = 5;
 	text_out16(title_x, title_y, menu_sel_color, title);
 
 	// 留3行显示help
-	msg_x = 5;
-	msg_sy = g_menuscreen_h - me_sfont_h * 3;
+	msg_sy = g_menuscreen_h - me_sfont_h * ME_MSG_LINES;
 
 	// 获取列表最小起始y位置,与title隔一行
 	listview_sy = title_y + 2 * me_mfont_h;
-	// 获取绘画列表高度
-	listview_h = msg_sy - listview_sy;
-	// 获取列表绘画行数
-	n_draw_items = listview_h / me_mfont_h;
-	half_draw_items = n_draw_items / 2;
-	// 获取列表终止dy位置
-	listview_dy = listview_sy + n_draw_items * me_mfont_h;
-	// 获取第一个绘画item index
-	top_idx = m_sel - half_draw_items;
-	if (top_idx > n_enable_entries - n_draw_items)
-		top_idx = n_enable_entries - n_draw_items;
-	if (top_idx < 0)
-		top_idx = 0;
+	menu_list_layout(&list, listview_sy, msg_sy - listview_sy, n_enabled, m_sel);
 
-	for (i = 0; i < n_enable_entries; i++)
+	// name column width, only redone when the names shown change
+	col_key = me_col_names_key(entries);
+	if (me_col_w < 0 || me_col_key != col_key)
 	{
-		ent = enable_entries[i];
-		wt = 0;
-		name = ent->name;
-		if (strlen(name) == 0)
+		me_col_key = col_key;
+		me_col_w = 0;
+		for (ent = entries; ent->name; ent++)
 		{
-			if (ent->generate_name)
-				name = ent->generate_name(ent->id);
+			if (!ent->enabled)
+				continue;
+			wt = fontcache_text_width(me_mfont_cache, ent->name);
+			if (me_col_w < wt)
+				me_col_w = wt;
 		}
-		if (name != NULL)
-			TTF_SizeUTF8(me_mfont, ent->name, &wt, NULL);
-
-		if (item_left_w < wt)
-
-			item_left_w = wt;
 	}
 
-	sel_x = 5;
-	sel_y = listview_sy + (m_sel - top_idx) * me_mfont_h;
-	listview_x = sel_x + menu_draw_selection(sel_x, sel_y) + 5;
-	listview_x2 = listview_x + item_left_w + me_mfont_w * 2;
+	listview_x = menu_list_draw_sel(&list, m_sel);
+	listview_x2 = listview_x + me_col_w + me_mfont_w * 2;
 
-	y = listview_sy;
-	for (i = top_idx; i < n_enable_entries; i++)
-	{
-		if (y >= listview_dy)
+	// skip to the first visible entry
+	for (ent = entries, i = -1; ent->name; ent++)
+		if (ent->enabled && ++i == list.top)
 			break;
 
-		ent = enable_entries[i];
+	for (i = list.top; i < list.end; ent++)
+	{
+		if (!ent->enabled)
+			continue;
+		y = menu_list_row_y(&list, i++);
 
-		name = ent->name;
-		if (strlen(name) == 0)
-		{
-			if (ent->generate_name)
-				name = ent->generate_name(ent->id);
-		}
+		name = me_entry_name(ent);
 		if (name != NULL)
 			text_out16(listview_x, y, menu_sel_color, name);
 
@@ -553,61 +857,14 @@ static void me_draw(const char *title, menu_entry *entries, int sel, void (*draw
 			}
 			break;
 		}
-
-		y += me_mfont_h;
 	}
 
 	menu_separation();
 
-	ent = enable_entries[m_sel];
-
-	if (menu_error_msg[0] != 0)
-	{
-		smalltext_out16(msg_x, msg_sy, menu_sel_color, menu_error_msg);
-
-		if (plat_get_ticks_ms() - menu_error_time > 2048)
-			menu_error_msg[0] = 0;
-	}
-	else if (ent->help != NULL)
-	{
-		int len = strlen(ent->help);
-		int i, l = 1;
-		for (i = 0; i < len; i++)
-		{
-			if (ent->help[i] == '\n')
-				l++;
-		}
-		if (l <= 3)
-		{
-			y = msg_sy + me_sfont_h * (3 - l);
-
-			char *buf = malloc(len + 1);
-			strcpy(buf, ent->help);
-			char *p = buf;
-			char *p2;
-			for (i = 0; i < l; i++)
-			{
-				p2 = strchr(p, '\n');
-				if (p2)
-					*p2++ = '\0';
-				smalltext_out16(msg_x, y, 0xffff, p);
-				p = p2;
-				y += me_sfont_h;
-			}
-			free(buf);
-		}
-		else
-		{
-			lprintf("menu msg doesn't fit!\n");
-		}
-	}
+	me_draw_msg(entries + sel);
 
 	menu_separation();
 
-finish:
-	if (enable_entries)
-		free(enable_entries);
-
 	if (draw_more != NULL)
 		draw_more();
 
@@ -652,7 +909,7 @@ static void debug_menu_loop(void);
 
 static int me_loop_d(const char *title, menu_entry *menu, int *menu_sel, void (*draw_prep)(void), void (*draw_more)(void))
 {
-	int ret = 0, inp, sel = *menu_sel, menu_sel_max;
+	int ret = 0, inp, sel = *menu_sel, menu_sel_max, drawn_sel, redraw;
 
 	menu_sel_max = me_count(menu) - 1;
 	if (menu_sel_max < 0)
@@ -669,12 +926,41 @@ static int me_loop_d(const char *title, menu_entry *menu, int *menu_sel, void (*
 	while (in_menu_wait_any(NULL, 50) & (PBTN_MOK | PBTN_MBACK | PBTN_MENU))
 		;
 
+	drawn_sel = sel;
+	redraw = MENU_REDRAW_ALL;
+
 	for (;;)
 	{
 		if (draw_prep != NULL)
+		{
+			// can't tell what it changed
 			draw_prep();
+			menu_bg_changed();
+			redraw |= MENU_REDRAW_ALL;
+		}
+		if (sel != drawn_sel)
+			redraw |= MENU_REDRAW_ALL;
+		if (strcmp(menu_drawn_msg, menu_error_msg) != 0)
+			redraw |= MENU_REDRAW_MSG;
+
+		if (redraw & MENU_REDRAW_ALL)
+		{
+			me_draw(title, menu, sel, draw_more);
+			drawn_sel = sel;
+		}
+		else if (redraw & MENU_REDRAW_MSG)
+		{
+			if (menu_draw_begin_lines(g_menuscreen_h - me_sfont_h * ME_MSG_LINES,
+									  me_sfont_h * ME_MSG_LINES))
+			{
+				me_draw_msg(&menu[sel]);
+				menu_draw_end();
+			}
+			else
+				me_draw(title, menu, sel, draw_more);
+		}
+		redraw = 0;
 
-		me_draw(title, menu, sel, draw_more);
 		inp = in_menu_wait(PBTN_UP | PBTN_DOWN | PBTN_LEFT | PBTN_RIGHT |
 							   PBTN_MOK | PBTN_MBACK | PBTN_MENU | PBTN_L | PBTN_R,
 						   NULL, 70);
@@ -702,13 +988,19 @@ static int me_loop_d(const char *title, menu_entry *menu, int *menu_sel, void (*
 
 		/* a bit hacky but oh well */
 		if ((inp & (PBTN_L | PBTN_R)) == (PBTN_L | PBTN_R))
+		{
 			debug_menu_loop();
+			redraw |= MENU_REDRAW_ALL;
+		}
 
 		if (inp & (PBTN_LEFT | PBTN_RIGHT | PBTN_L | PBTN_R))
 		{ /* multi choice */
 			if (me_process(&menu[sel], (inp & (PBTN_RIGHT | PBTN_R)) ? 1 : 0,
 						   inp & (PBTN_L | PBTN_R)))
+			{
+				redraw |= MENU_REDRAW_ALL;
 				continue;
+			}
 		}
 
 		if (inp & (PBTN_MOK | PBTN_LEFT | PBTN_RIGHT | PBTN_L | PBTN_R))
@@ -717,6 +1009,8 @@ static int me_loop_d(const char *title, menu_entry *menu, int *menu_sel, void (*
 			if (menu[sel].handler != NULL && (menu[sel].beh != MB_NONE || (inp & PBTN_MOK)))
 			{
 				ret = menu[sel].handler(menu[sel].id, inp);
+				// may change anything or draw its own screens
+				redraw |= MENU_REDRAW_ALL;
 				if (ret)
 					break;
 				menu_sel_max = me_count(menu) - 1; /* might change, so update */
@@ -760,7 +1054,7 @@ static void draw_menu_message(const char *msg, void (*draw_more)(void))
 		{
 			wt = 0;
 			buf[i] = '\0';
-			TTF_SizeUTF8(me_mfont, p, &wt, NULL);
+			wt = fontcache_text_width(me_mfont_cache, p);
 			buf[i] = '\n';
 			if (w < wt)
 				w = wt;
@@ -783,7 +1077,7 @@ static void draw_menu_message(const char *msg, void (*draw_more)(void))
 		{
 			wt = 0;
 			buf[i] = '\0';
-			TTF_SizeUTF8(me_mfont, p, &wt, NULL);
+			wt = fontcache_text_width(me_mfont_cache, p);
 			buf[i] = '\n';
 			if (w < wt)
 				w = wt;
@@ -853,6 +1147,20 @@ static void do_delete(const char *fpath, const char *fname)
 
 // -------------- ROM selector --------------
 
+static void draw_dirlist_help(void)
+{
+	int msg_x = 5, y = g_menuscreen_h - me_sfont_h * ME_MSG_LINES;
+
+	smalltext_out16(msg_x, y, 0xe78c, "%s - 選擇, %s - 返回",
+					in_get_key_name(-1, -PBTN_MOK), in_get_key_name(-1, -PBTN_MBACK));
+	y += me_sfont_h;
+	smalltext_out16(msg_x, y, 0xe78c, g_menu_filter_off ? "%s - 隱藏未知文件" : "%s - 顯示全部文件",
+					in_get_key_name(-1, -PBTN_MA3));
+	y += me_sfont_h;
+	smalltext_out16(msg_x, y, 0xe78c, g_autostateld_opt ? "%s - 已開啟自動加載存檔" : "%s - 已關閉自動加載存檔",
+					in_get_key_name(-1, -PBTN_MA2));
+}
+
 static void draw_dirlist(char *curdir, struct dirent **namelist,
 						 int list_len, int sel, int show_help)
 {
@@ -860,13 +1168,11 @@ static void draw_dirlist(char *curdir, struct dirent **namelist,
 	char *pcurdir;
 	char curdir_buf[256];
 	int curdir_x, curdir_y;
-	int msg_x, msg_sy;
-	int sel_x, sel_y;
-	int listview_h;
-	int listview_x, listview_sy, listview_dy;
-	int n_draw_items, half_draw_items, top_idx;
+	int msg_sy;
+	int sel_y;
+	int listview_x, listview_sy;
+	struct menu_list list;
 
-	void *darken_ptr;
 	int i, x, y;
 
 	menu_draw_begin(1, 0);
@@ -876,7 +1182,7 @@ static void draw_dirlist(char *curdir, struct dirent **namelist,
 	if (curdir)
 	{
 		pcurdir = curdir;
-		TTF_SizeUTF8(me_mfont, curdir, &wt, NULL);
+		wt = fontcache_text_width(me_mfont_cache, curdir);
 		// 过长截断
 		if (wt > g_menuscreen_w - 10)
 		{
@@ -893,38 +1199,21 @@ static void draw_dirlist(char *curdir, struct dirent **namelist,
 	// help
 	msg_sy = g_menuscreen_h;
 	if (show_help)
-		msg_sy -= me_sfont_h * 3;
+		msg_sy -= me_sfont_h * ME_MSG_LINES;
 
 	// 获取列表起始y位置,与title隔一行
 	listview_sy = curdir_y + 2 * me_mfont_h;
-	// 获取绘画列表高度
-	listview_h = msg_sy - listview_sy;
-	// 获取列表绘画行数
-	n_draw_items = listview_h / me_mfont_h;
-	half_draw_items = n_draw_items / 2;
-	// 获取列表终止dy位置
-	listview_dy = listview_sy + n_draw_items * me_mfont_h;
-	// 获取第一个绘画item index
-	top_idx = sel - half_draw_items;
-	if (top_idx > list_len - n_draw_items)
-		top_idx = list_len - n_draw_items;
-	if (top_idx < 0)
-		top_idx = 0;
+	menu_list_layout(&list, listview_sy, msg_sy - listview_sy, list_len, sel);
 
-	sel_x = 5;
-	sel_y = listview_sy + (sel - top_idx) * me_mfont_h;
-	darken_ptr = (short *)g_menuscreen_surface->pixels + g_menuscreen_pp * (sel_y - 2);
+	sel_y = menu_list_row_y(&list, sel);
 	SDL_LockSurface(g_menuscreen_surface);
-	menu_darken_bg(darken_ptr, darken_ptr, g_menuscreen_pp * (me_mfont_h + 4), 1);
+	menu_darken_lines(sel_y - 2, me_mfont_h + 4);
 	SDL_UnlockSurface(g_menuscreen_surface);
-	listview_x = sel_x + menu_draw_selection(sel_x, sel_y) + 5;
-
-	y = listview_sy;
-	for (i = top_idx; i < list_len; i++)
-	{
-		if (y >= listview_dy)
-			break;
+	listview_x = menu_list_draw_sel(&list, sel);
 
+	for (i = list.top; i < list.end; i++)
+	{
+		y = menu_list_row_y(&list, i);
 		if (namelist[i]->d_type == DT_DIR)
 		{
 			x = listview_x;
@@ -936,21 +1225,10 @@ static void draw_dirlist(char *curdir, struct dirent **namelist,
 		{
 			text_out16(listview_x, y, 0xfff6, namelist[i]->d_name);
 		}
-		y += me_mfont_h;
 	}
 
 	if (show_help)
-	{
-		y = msg_sy;
-		smalltext_out16(msg_x, y, 0xe78c, "%s - 選擇, %s - 返回",
-						in_get_key_name(-1, -PBTN_MOK), in_get_key_name(-1, -PBTN_MBACK));
-		y += me_sfont_h;
-		smalltext_out16(msg_x, y, 0xe78c, g_menu_filter_off ? "%s - 隱藏未知文件" : "%s - 顯示全部文件",
-						in_get_key_name(-1, -PBTN_MA3));
-		y += me_sfont_h;
-		smalltext_out16(msg_x, y, 0xe78c, g_autostateld_opt ? "%s - 已開啟自動加載存檔" : "%s - 已關閉自動加載存檔",
-						in_get_key_name(-1, -PBTN_MA2));
-	}
+		draw_dirlist_help();
 
 	menu_draw_end();
 }
@@ -1008,25 +1286,6 @@ static int scandir_filter(const struct dirent *ent)
 	return 0;
 }
 
-static int dirent_seek_char(struct dirent **namelist, int len, int sel, char c)
-{
-	int i;
-
-	sel++;
-	for (i = sel + 1;; i++)
-	{
-		if (i >= len)
-			i = 1;
-		if (i == sel)
-			break;
-
-		if (tolower_simple(namelist[i]->d_name[0]) == c)
-			break;
-	}
-
-	return i - 1;
-}
-
 static int menu_make_file_name(char *name, char *path, int size)
 {
 	if (!name || !path)
@@ -1059,22 +1318,230 @@ failed:
 	return -1;
 }
 
+static int dirlist_scan_done;
+
+/* Takes entries scanned so far and merges them into the sorted list.
+ * The selected entry stays selected, or if want_name is given and shows
+ * up, it becomes the selection. */
+static int dirlist_collect(struct dirscan *ds, struct dirent ***namelist_,
+						   int n, int *sel, const char *want_name)
+{
+	struct dirent **namelist, **tmp, *keep = NULL;
+	int old_n = n, i, j, k;
+
+	n = dirscan_collect(ds, namelist_, n, &dirlist_scan_done);
+	if (n == old_n)
+		return n;
+
+	namelist = *namelist_;
+	if (*sel < old_n)
+		keep = namelist[*sel];
+	if (want_name != NULL)
+	{
+		for (i = old_n; i < n; i++)
+			if (strcmp(namelist[i]->d_name, want_name) == 0)
+				keep = namelist[i];
+	}
+
+	qsort(namelist + old_n, n - old_n, sizeof(namelist[0]), scandir_cmp);
+	tmp = malloc(n * sizeof(tmp[0]));
+	if (tmp != NULL)
+	{
+		for (i = 0, j = old_n, k = 0; i < old_n && j < n;)
+			tmp[k++] = scandir_cmp(&namelist[j], &namelist[i]) < 0 ?
+				namelist[j++] : namelist[i++];
+		while (i < old_n)
+			tmp[k++] = namelist[i++];
+		while (j < n)
+			tmp[k++] = namelist[j++];
+		memcpy(namelist, tmp, n * sizeof(tmp[0]));
+		free(tmp);
+	}
+	else
+		qsort(namelist, n, sizeof(namelist[0]), scandir_cmp);
+
+	for (i = 0; i < n && keep != NULL; i++)
+	{
+		if (namelist[i] == keep)
+		{
+			*sel = i;
+			break;
+		}
+	}
+
+	return n;
+}
+
+/* frontend's filter wants the complete list, so it runs once scanning is done */
+static int dirlist_extra_filter(struct dirent **namelist, int n, int *sel, const char *dir,
+								int (*extra_filter)(struct dirent **namelist, int count,
+													const char *basedir))
+{
+	char name[256];
+	int i;
+
+	name[0] = 0;
+	if (*sel < n)
+		snprintf(name, sizeof(name), "%s", namelist[*sel]->d_name);
+
+	n = extra_filter(namelist, n, dir);
+	if (n > 1)
+		qsort(namelist, n, sizeof(namelist[0]), scandir_cmp);
+
+	if (*sel > n - 1)
+		*sel = n > 0 ? n - 1 : 0;
+	for (i = 0; i < n; i++)
+	{
+		if (strcmp(namelist[i]->d_name, name) == 0)
+		{
+			*sel = i;
+			break;
+		}
+	}
+
+	return n;
+}
+
+/* identifies what a cached listing was filtered with */
+static unsigned long long dirlist_cache_key(const char **filter_exts, void *extra_filter)
+{
+	unsigned long long key = g_menu_filter_off ? 1 : 2;
+	int i;
+
+	if (g_menu_filter_off)
+		return key;
+	for (i = 0; filter_exts != NULL && filter_exts[i] != NULL; i++)
+		key = key * 31 + fastmem_hash(filter_exts[i], strlen(filter_exts[i]));
+	if (extra_filter != NULL)
+		key ^= 0x8000000000000000ull;
+
+	return key;
+}
+
+/* type-to-filter state, view[] lists the matching namelist entries */
+struct dirlist_search
+{
+	char text[64];
+	struct listindex *li;
+	int *match;
+	struct dirent **view;
+	int alloc;
+	int count;
+};
+
+/* namelist changed, the index has to be rebuilt */
+static void dirlist_search_invalidate(struct dirlist_search *s)
+{
+	listindex_free(s->li);
+	s->li = NULL;
+}
+
+static void dirlist_search_free(struct dirlist_search *s)
+{
+	dirlist_search_invalidate(s);
+	free(s->match);
+	free(s->view);
+	s->match = NULL;
+	s->view = NULL;
+	s->alloc = s->count = 0;
+}
+
+/* view position -> namelist position */
+static int dirlist_search_pos(const struct dirlist_search *s, int sel)
+{
+	if (s->text[0] == 0 || sel >= s->count)
+		return sel;
+	return s->match[sel];
+}
+
+/* Matches namelist against the search text, the index is built on first
+ * use. Returns the view position of namelist entry lsel, or 0 if it's
+ * filtered out. */
+static int dirlist_search_update(struct dirlist_search *s, struct dirent **namelist,
+								 int n, int lsel)
+{
+	const char **names;
+	void *tmp;
+	int i;
+
+	s->count = n;
+	if (s->text[0] == 0)
+		return lsel;
+
+	if (s->alloc < n)
+	{
+		tmp = realloc(s->match, n * sizeof(s->match[0]));
+		if (tmp == NULL)
+			goto fail;
+		s->match = tmp;
+		tmp = realloc(s->view, n * sizeof(s->view[0]));
+		if (tmp == NULL)
+			goto fail;
+		s->view = tmp;
+		s->alloc = n;
+	}
+	if (s->li == NULL)
+	{
+		names = malloc((n + 1) * sizeof(names[0]));
+		if (names == NULL)
+			goto fail;
+		for (i = 0; i < n; i++)
+			names[i] = namelist[i]->d_name;
+		s->li = listindex_new(names, n);
+		free(names);
+		if (s->li == NULL)
+			goto fail;
+	}
+
+	s->count = listindex_match(s->li, s->text, 1, s->match);
+	for (i = 0; i < s->count; i++)
+		s->view[i] = namelist[s->match[i]];
+	for (i = 0; i < s->count; i++)
+		if (s->match[i] == lsel)
+			return i;
+	return 0;
+
+fail:
+	lprintf("dirlist search: OOM\n");
+	s->text[0] = 0;
+	s->count = n;
+	return lsel;
+}
+
+/* current dir, with the search text while filtering */
+static char *dirlist_title(char *buf, int size, char *curr_path,
+						   const struct dirlist_search *s)
+{
+	if (s->text[0] == 0)
+		return curr_path;
+	snprintf(buf, size, "%s  [%s_]", curr_path, s->text);
+	return buf;
+}
+
 static const char *menu_loop_romsel(char *curr_path, int len,
 									const char **filter_exts,
 									int (*extra_filter)(struct dirent **namelist, int count,
 														const char *basedir))
 {
-	static char rom_fname_reload[256]; // used for scratch and return
+	static char rom_fname_reload[256]; // used for return
 	static char sel_fname[256] = {0};
 	int (*filter)(const struct dirent *);
 	struct dirent **namelist = NULL;
 	int n = 0, inp = 0, sel = 0, show_help = 0;
+	int drawn_sel, drawn_help, redraw = 0;
+	struct dirscan *ds = NULL;
+	struct dirlist_search search;
+	struct dirent **list;
+	char title[320];
+	unsigned long long cache_key;
+	int sel_pending;
 	char *curr_path_restore = NULL;
 	const char *ret = NULL;
 	char cinp;
-	int r, i;
+	int i;
 
 	filter_exts_internal = filter_exts;
+	memset(&search, 0, sizeof(search));
 
 	// is this a dir or a full path?
 	if (!plat_is_dir(curr_path))
@@ -1092,6 +1559,9 @@ static const char *menu_loop_romsel(char *curr_path, int len,
 	}
 
 rescan:
+	dirscan_finish(ds);
+	ds = NULL;
+	dirlist_search_invalidate(&search);
 	if (namelist != NULL)
 	{
 		while (n-- > 0)
@@ -1099,97 +1569,140 @@ rescan:
 		free(namelist);
 		namelist = NULL;
 	}
+	n = 0;
 
 	filter = NULL;
 	if (!g_menu_filter_off)
 		filter = scandir_filter;
 
-	n = scandir(curr_path, &namelist, filter, (void *)scandir_cmp);
-	if (n < 0)
+	sel = 0;
+	sel_pending = sel_fname[0] != 0;
+
+	cache_key = dirlist_cache_key(filter_exts, extra_filter);
+	n = dircache_load(curr_path, cache_key, &namelist);
+	if (n >= 0)
+	{
+		for (i = 0; i < n && sel_pending; i++)
+		{
+			if (strcmp(namelist[i]->d_name, sel_fname) == 0)
+			{
+				sel = i;
+				sel_pending = 0;
+			}
+		}
+		goto scanned;
+	}
+	n = 0;
+
+	// entries arrive in the background, see dirlist_collect()
+	ds = dirscan_start(curr_path, filter);
+	if (ds == NULL)
 	{
 		lprintf("menu_loop_romsel failed, dir: %s\n", curr_path);
 
 		// try data root
 		plat_get_data_dir(curr_path, len);
-		n = scandir(curr_path, &namelist, filter, (void *)scandir_cmp);
-		if (n < 0)
+		ds = dirscan_start(curr_path, filter);
+		if (ds == NULL)
 		{
 			// oops, we failed
 			lprintf("menu_loop_romsel failed, dir: %s\n", curr_path);
+			dirlist_search_free(&search);
 			return NULL;
 		}
 	}
 
-	// try to resolve DT_UNKNOWN and symlinks
-	for (i = 0; i < n; i++)
-	{
-		struct stat st;
-		char *slash;
+scanned:
+	sel = dirlist_search_update(&search, namelist, n, sel);
+	list = search.text[0] ? search.view : namelist;
 
-		if (namelist[i]->d_type == DT_REG || namelist[i]->d_type == DT_DIR)
-			continue;
+	/* make sure action buttons are not pressed on entering menu */
+	draw_dirlist(dirlist_title(title, sizeof(title), curr_path, &search),
+				 list, search.count, sel, show_help);
+	while (in_menu_wait_any(NULL, 50) & (PBTN_MOK | PBTN_MBACK | PBTN_MENU))
+		;
+	drawn_sel = sel;
+	drawn_help = show_help > 0;
 
-		r = strlen(curr_path);
-		slash = (r && curr_path[r - 1] == '/') ? "" : "/";
-		snprintf(rom_fname_reload, sizeof(rom_fname_reload),
-				 "%s%s%s", curr_path, slash, namelist[i]->d_name);
-		r = stat(rom_fname_reload, &st);
-		if (r == 0)
+	for (;;)
+	{
+		if (ds != NULL)
 		{
-			if (S_ISREG(st.st_mode))
-				namelist[i]->d_type = DT_REG;
-			else if (S_ISDIR(st.st_mode))
-				namelist[i]->d_type = DT_DIR;
+			i = n;
+			sel = dirlist_search_pos(&search, sel);
+			n = dirlist_collect(ds, &namelist, n, &sel, sel_pending ? sel_fname : NULL);
+			if (n != i)
+			{
+				if (sel_pending && sel < n && strcmp(namelist[sel]->d_name, sel_fname) == 0)
+					sel_pending = 0;
+				dirlist_search_invalidate(&search);
+				redraw |= MENU_REDRAW_ALL;
+			}
+			if (dirlist_scan_done)
+			{
+				dirscan_finish(ds);
+				ds = NULL;
+				if (!g_menu_filter_off && extra_filter != NULL)
+					n = dirlist_extra_filter(namelist, n, &sel, curr_path, extra_filter);
+				// don't let a partial list be served until the dir changes
+				if (dirlist_scan_done > 0)
+					dircache_save(curr_path, cache_key, namelist, n);
+				dirlist_search_invalidate(&search);
+				redraw |= MENU_REDRAW_ALL;
+			}
+			sel = dirlist_search_update(&search, namelist, n, sel);
 		}
-	}
+		list = search.text[0] ? search.view : namelist;
 
-	if (!g_menu_filter_off && extra_filter != NULL)
-		n = extra_filter(namelist, n, curr_path);
+		// help lines take list space, so showing/hiding them is a full redraw
+		if (sel != drawn_sel || (show_help > 0) != drawn_help)
+			redraw |= MENU_REDRAW_ALL;
 
-	if (n > 1)
-		qsort(namelist, n, sizeof(namelist[0]), scandir_cmp);
-
-	// try to find selected file
-	sel = 0;
-	if (sel_fname[0] != 0)
-	{
-		for (i = 0; i < n; i++)
+		if (redraw & MENU_REDRAW_ALL)
+		{
+			draw_dirlist(dirlist_title(title, sizeof(title), curr_path, &search),
+						 list, search.count, sel, show_help);
+			drawn_sel = sel;
+			drawn_help = show_help > 0;
+		}
+		else if (redraw & MENU_REDRAW_MSG)
 		{
-			char *dname = namelist[i]->d_name;
-			if (dname[0] == sel_fname[0] && strcmp(dname, sel_fname) == 0)
+			if (menu_draw_begin_lines(g_menuscreen_h - me_sfont_h * ME_MSG_LINES,
+									  me_sfont_h * ME_MSG_LINES))
 			{
-				sel = i;
-				break;
+				draw_dirlist_help();
+				menu_draw_end();
 			}
+			else
+				draw_dirlist(dirlist_title(title, sizeof(title), curr_path, &search),
+							 list, search.count, sel, show_help);
 		}
-	}
-
-	/* make sure action buttons are not pressed on entering menu */
-	draw_dirlist(curr_path, namelist, n, sel, show_help);
-	while (in_menu_wait_any(NULL, 50) & (PBTN_MOK | PBTN_MBACK | PBTN_MENU))
-		;
+		redraw = 0;
 
-	for (;;)
-	{
-		draw_dirlist(curr_path, namelist, n, sel, show_help);
-		inp = in_menu_wait(PBTN_UP | PBTN_DOWN | PBTN_LEFT | PBTN_RIGHT | PBTN_L | PBTN_R | PBTN_MA2 | PBTN_MA3 | PBTN_MOK | PBTN_MBACK | PBTN_MENU | PBTN_CHAR, &cinp, 33);
+		// don't block while the list is still filling up
+		inp = in_menu_wait_timeout(PBTN_UP | PBTN_DOWN | PBTN_LEFT | PBTN_RIGHT | PBTN_L | PBTN_R | PBTN_MA2 | PBTN_MA3 | PBTN_MOK | PBTN_MBACK | PBTN_MENU | PBTN_CHAR, &cinp, 33,
+								   ds != NULL ? 50 : -1);
+		if (inp == 0)
+			continue;
+		if (inp & (PBTN_UP | PBTN_DOWN | PBTN_LEFT | PBTN_RIGHT | PBTN_L | PBTN_R | PBTN_CHAR))
+			sel_pending = 0; // user took over
 		if (inp & PBTN_MA3)
 		{
 			g_menu_filter_off = !g_menu_filter_off;
 			snprintf(sel_fname, sizeof(sel_fname), "%s",
-					 namelist[sel]->d_name);
+					 search.count > 0 ? list[sel]->d_name : "");
 			goto rescan;
 		}
 		if (inp & PBTN_UP)
 		{
 			sel--;
 			if (sel < 0)
-				sel = n - 1;
+				sel = search.count - 1;
 		}
 		if (inp & PBTN_DOWN)
 		{
 			sel++;
-			if (sel > n - 1)
+			if (sel > search.count - 1)
 				sel = 0;
 		}
 		if (inp & PBTN_LEFT)
@@ -1207,44 +1720,46 @@ rescan:
 		if (inp & PBTN_RIGHT)
 		{
 			sel += 10;
-			if (sel > n - 1)
-				sel = n - 1;
+			if (sel > search.count - 1)
+				sel = search.count - 1;
 		}
 		if (inp & PBTN_R)
 		{
 			sel += 24;
-			if (sel > n - 1)
-				sel = n - 1;
+			if (sel > search.count - 1)
+				sel = search.count - 1;
 		}
+		if (sel < 0) // empty list
+			sel = 0;
 
-		if ((inp & PBTN_MOK) || (inp & (PBTN_MENU | PBTN_MA2)) == (PBTN_MENU | PBTN_MA2))
+		if (search.count > 0 && ((inp & PBTN_MOK) || (inp & (PBTN_MENU | PBTN_MA2)) == (PBTN_MENU | PBTN_MA2)))
 		{
-			if (namelist[sel]->d_type == DT_REG)
+			if (list[sel]->d_type == DT_REG)
 			{
 				int l = strlen(curr_path);
 				char *slash = l && curr_path[l - 1] == '/' ? "" : "/";
 				snprintf(rom_fname_reload, sizeof(rom_fname_reload),
-						 "%s%s%s", curr_path, slash, namelist[sel]->d_name);
+						 "%s%s%s", curr_path, slash, list[sel]->d_name);
 
 				if (inp & PBTN_MOK)
 				{ // return sel
 					ret = rom_fname_reload;
 					break;
 				}
-				do_delete(rom_fname_reload, namelist[sel]->d_name);
+				do_delete(rom_fname_reload, list[sel]->d_name);
 				goto rescan;
 			}
-			else if (namelist[sel]->d_type == DT_DIR)
+			else if (list[sel]->d_type == DT_DIR)
 			{
 				int newlen;
 				char *p, *newdir;
 				if (!(inp & PBTN_MOK))
 					continue;
-				newlen = strlen(curr_path) + strlen(namelist[sel]->d_name) + 2;
+				newlen = strlen(curr_path) + strlen(list[sel]->d_name) + 2;
 				newdir = malloc(newlen);
 				if (newdir == NULL)
 					break;
-				if (strcmp(namelist[sel]->d_name, "..") == 0)
+				if (strcmp(list[sel]->d_name, "..") == 0)
 				{
 					menu_make_file_name(sel_fname, curr_path, sizeof(sel_fname));
 
@@ -1266,9 +1781,11 @@ rescan:
 					while (*p == '/' && p >= newdir)
 						*p-- = 0;
 					strcat(newdir, "/");
-					strcat(newdir, namelist[sel]->d_name);
+					strcat(newdir, list[sel]->d_name);
 					sel_fname[0] = '\0';
 				}
+				dirscan_finish(ds);
+				ds = NULL;
 				ret = menu_loop_romsel(newdir, newlen, filter_exts, extra_filter);
 				free(newdir);
 				break;
@@ -1278,24 +1795,43 @@ rescan:
 		{
 			g_autostateld_opt = !g_autostateld_opt;
 			show_help = 3;
+			redraw |= MENU_REDRAW_MSG;
 		}
 		else if (inp & PBTN_CHAR)
 		{
 			// must be last
-			sel = dirent_seek_char(namelist, n, sel, cinp);
+			i = strlen(search.text);
+			if ((unsigned char)cinp >= ' ' && i < (int)sizeof(search.text) - 1)
+			{
+				sel = dirlist_search_pos(&search, sel);
+				search.text[i] = cinp;
+				search.text[i + 1] = 0;
+				sel = dirlist_search_update(&search, namelist, n, sel);
+				redraw |= MENU_REDRAW_ALL;
+			}
 		}
 
 		if (inp & PBTN_MBACK)
 		{
-			sel_fname[0] = '\0';
-			break;
+			if (search.text[0] == 0)
+			{
+				sel_fname[0] = '\0';
+				break;
+			}
+			// backspace while filtering
+			sel = dirlist_search_pos(&search, sel);
+			search.text[strlen(search.text) - 1] = 0;
+			sel = dirlist_search_update(&search, namelist, n, sel);
+			redraw |= MENU_REDRAW_ALL;
 		}
 
 		if (show_help > 0)
 			show_help--;
 	}
 
-	if (n > 0)
+	dirscan_finish(ds);
+	dirlist_search_free(&search);
+	if (namelist != NULL)
 	{
 		while (n-- > 0)
 			free(namelist[n]);
@@ -1313,75 +1849,283 @@ rescan:
 
 #define STATE_SLOT_COUNT 20
 
+// last known slot state, kept between menu visits
 static int state_slot_flags = 0;
+static int state_slot_known = 0;
 static int state_slot_times[STATE_SLOT_COUNT];
 
-static void state_check_slots(void)
+/* Slots are checked again on a thread every time the menu opens, the
+ * cached state is shown meanwhile. emu_check_save_file() and friends
+ * may share buffers, so there is one probe thread, and no other emu_*
+ * call may happen until state_check_slots_finish(). */
+static pthread_t state_probe_thread;
+static pthread_mutex_t state_probe_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int state_probe_running;
+static int state_probe_first;
+static int state_probe_done, state_probe_flags;
+static int state_probe_times[STATE_SLOT_COUNT];
+
+static void *state_probe_worker(void *arg)
+{
+	int i, slot, mtime, ok;
+
+	// selection first, then what's below it
+	for (i = 0; i < STATE_SLOT_COUNT; i++)
+	{
+		slot = (state_probe_first + i) % STATE_SLOT_COUNT;
+		mtime = 0;
+		ok = emu_check_save_file(slot, &mtime);
+
+		pthread_mutex_lock(&state_probe_mutex);
+		if (ok)
+			state_probe_flags |= 1 << slot;
+		state_probe_times[slot] = mtime;
+		state_probe_done |= 1 << slot;
+		pthread_mutex_unlock(&state_probe_mutex);
+	}
+	in_wakeup(); // show the results without waiting out the timeout
+
+	return NULL;
+}
+
+static void state_check_slots_start(int first)
+{
+	state_probe_first = first;
+	state_probe_done = state_probe_flags = 0;
+	state_probe_running = 1;
+	if (pthread_create(&state_probe_thread, NULL, state_probe_worker, NULL) != 0)
+	{
+		state_probe_worker(NULL);
+		state_probe_thread = pthread_self();
+	}
+}
+
+/* takes slots checked so far, returns nonzero if something changed */
+static int state_check_slots_collect(void)
 {
-	int slot;
+	int slot, changed = 0, done;
 
-	state_slot_flags = 0;
+	if (!state_probe_running)
+		return 0;
 
+	pthread_mutex_lock(&state_probe_mutex);
+	done = state_probe_done;
 	for (slot = 0; slot < STATE_SLOT_COUNT; slot++)
 	{
-		state_slot_times[slot] = 0;
-		if (emu_check_save_file(slot, &state_slot_times[slot]))
-			state_slot_flags |= 1 << slot;
+		int bit = 1 << slot;
+		if (!(done & bit))
+			continue;
+		if ((state_slot_flags & bit) != (state_probe_flags & bit)
+			|| state_slot_times[slot] != state_probe_times[slot] || !(state_slot_known & bit))
+			changed = 1;
+		state_slot_flags = (state_slot_flags & ~bit) | (state_probe_flags & bit);
+		state_slot_times[slot] = state_probe_times[slot];
+	}
+	state_slot_known |= done;
+	pthread_mutex_unlock(&state_probe_mutex);
+
+	if (done == (1 << STATE_SLOT_COUNT) - 1)
+	{
+		if (!pthread_equal(state_probe_thread, pthread_self()))
+			pthread_join(state_probe_thread, NULL);
+		state_probe_running = 0;
+	}
+
+	return changed;
+}
+
+static void state_check_slots_finish(void)
+{
+	if (!state_probe_running)
+		return;
+	if (!pthread_equal(state_probe_thread, pthread_self()))
+	{
+		pthread_join(state_probe_thread, NULL);
+		state_probe_thread = pthread_self(); // joined
 	}
+	state_check_slots_collect();
 }
 
 static void draw_savestate_bg(int slot);
 
+/* Slot previews, as draw_savestate_bg() left them in g_menubg_ptr.
+ * Previews load the state into the emulator, so they are made on this
+ * thread while the menu is idle, nearest slots first. */
+#define STATE_THUMB_BYTES (4 * 1024 * 1024)
+#define STATE_THUMB_AHEAD 2
+
+struct state_thumb
+{
+	int slot; // -1 if unused
+	int time;
+	unsigned int used; // for LRU
+	void *pixels;
+};
+
+static struct state_thumb state_thumbs[STATE_SLOT_COUNT];
+static int state_thumb_count;
+static unsigned int state_thumb_stamp;
+static void *state_thumb_base; // shown until the preview is ready
+
+static void state_thumbs_free(void)
+{
+	int i;
+
+	for (i = 0; i < state_thumb_count; i++)
+		free(state_thumbs[i].pixels);
+	free(state_thumb_base);
+	state_thumb_base = NULL;
+	state_thumb_count = 0;
+}
+
+static int state_thumbs_init(void)
+{
+	size_t size = g_menuscreen_w * g_menuscreen_h * MENU_BYPP;
+	int i, count;
+
+	state_thumbs_free();
+
+	count = STATE_THUMB_BYTES / size;
+	if (count > STATE_SLOT_COUNT)
+		count = STATE_SLOT_COUNT;
+	if (count < 1)
+		count = 1;
+
+	state_thumb_base = malloc(size);
+	if (state_thumb_base == NULL)
+		return -1;
+	memcpy(state_thumb_base, g_menubg_ptr, size);
+
+	for (i = 0; i < count; i++)
+	{
+		state_thumbs[i].slot = -1;
+		state_thumbs[i].pixels = malloc(size);
+		if (state_thumbs[i].pixels == NULL)
+			break;
+	}
+	state_thumb_count = i;
+	if (state_thumb_count == 0)
+	{
+		state_thumbs_free();
+		return -1;
+	}
+
+	return 0;
+}
+
+static struct state_thumb *state_thumb_find(int slot)
+{
+	int i;
+
+	for (i = 0; i < state_thumb_count; i++)
+	{
+		if (state_thumbs[i].slot == slot && state_thumbs[i].time == state_slot_times[slot])
+		{
+			state_thumbs[i].used = ++state_thumb_stamp;
+			return &state_thumbs[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void state_thumb_load(int slot)
+{
+	struct state_thumb *t = &state_thumbs[0];
+	int i;
+
+	for (i = 1; i < state_thumb_count && t->slot >= 0; i++)
+		if (state_thumbs[i].slot < 0 || state_thumbs[i].used < t->used)
+			t = &state_thumbs[i];
+
+	draw_savestate_bg(slot);
+	memcpy(t->pixels, g_menubg_ptr, g_menuscreen_w * g_menuscreen_h * MENU_BYPP);
+	t->slot = slot;
+	t->time = state_slot_times[slot];
+	t->used = ++state_thumb_stamp;
+}
+
+/* makes one missing preview near sel, returns its slot or -1 if none */
+static int state_thumb_prefetch(int sel)
+{
+	int ahead = (state_thumb_count - 1) / 2;
+	int i, slot;
+
+	if (state_thumb_count == 0)
+		return -1;
+	if (ahead > STATE_THUMB_AHEAD)
+		ahead = STATE_THUMB_AHEAD;
+
+	// sel, sel+1, sel-1, sel+2, ...
+	for (i = 0; i <= ahead * 2; i++)
+	{
+		slot = sel + ((i & 1) ? (i + 1) / 2 : -(i / 2));
+		slot = (slot + STATE_SLOT_COUNT) % STATE_SLOT_COUNT;
+		if (!(state_slot_flags & (1 << slot)))
+			continue;
+		if (state_thumb_find(slot) == NULL)
+		{
+			state_thumb_load(slot);
+			return slot;
+		}
+	}
+
+	return -1;
+}
+
+/* puts the slot's preview, or the placeholder if it's not ready, to g_menubg_ptr */
+static void state_thumb_show(int slot)
+{
+	struct state_thumb *t = NULL;
+	size_t size = g_menuscreen_w * g_menuscreen_h * MENU_BYPP;
+
+	if (state_thumb_count == 0)
+	{
+		// no cache, do it the slow way
+		state_check_slots_finish();
+		if (state_slot_flags & (1 << slot))
+			draw_savestate_bg(slot);
+		menu_bg_changed();
+		return;
+	}
+
+	if (state_slot_flags & (1 << slot))
+		t = state_thumb_find(slot);
+	memcpy(g_menubg_ptr, t != NULL ? t->pixels : state_thumb_base, size);
+	menu_bg_changed();
+}
+
 static void draw_savestate_menu(int menu_sel, int is_loading)
 {
 	int wt;
 	int title_x, title_y;
-	int sel_x, sel_y;
-	int listview_h;
-	int listview_x, listview_sy, listview_dy;
-	int n_draw_items, half_draw_items, top_idx;
+	int listview_x, listview_sy;
+	struct menu_list list;
 	char *title;
 	char text_buf[64];
-
-	if (state_slot_flags & (1 << menu_sel))
-		draw_savestate_bg(menu_sel);
+	int i;
 
 	menu_draw_begin(1, 1);
 
 	title = is_loading ? "即時讀檔" : "即時存檔";
-	wt = 0;
-	TTF_SizeUTF8(me_mfont, title, &wt, NULL);
+	wt = fontcache_text_width(me_mfont_cache, title);
 	title_x = (g_menuscreen_w - wt) / 2;
 	title_y = 5;
 	text_out16(title_x, title_y, menu_sel_color, title);
 
-	// 获取列表起始y位置,与title隔一行
+	// 获取列表起始y位置,与title隔一行,底部留一行
 	listview_sy = title_y + 2 * me_mfont_h;
-	// 获取绘画列表高度,底部留一行
-	listview_h = g_menuscreen_h - me_mfont_h - listview_sy;
-	// 获取列表绘画行数
-	n_draw_items = listview_h / me_mfont_h;
-	half_draw_items = n_draw_items / 2;
-	// 获取列表终止dy位置
-	listview_dy = listview_sy + n_draw_items * me_mfont_h;
-	// 获取第一个绘画item index
-	top_idx = menu_sel - half_draw_items;
-	if (top_idx > STATE_SLOT_COUNT - n_draw_items)
-		top_idx = STATE_SLOT_COUNT - n_draw_items;
-	if (top_idx < 0)
-		top_idx = 0;
+	menu_list_layout(&list, listview_sy, g_menuscreen_h - me_mfont_h - listview_sy,
+					 STATE_SLOT_COUNT, menu_sel);
+	listview_x = menu_list_draw_sel(&list, menu_sel);
 
-	sel_x = 5;
-	sel_y = listview_sy + (menu_sel - top_idx) * me_mfont_h;
-	listview_x = sel_x + menu_draw_selection(sel_x, sel_y) + 5;
-
-	int i, y = listview_sy;
-	for (i = top_idx; i < STATE_SLOT_COUNT; i++)
+	for (i = list.top; i < list.end; i++)
 	{
-		if (y >= listview_dy)
-			break;
-
-		if (!(state_slot_flags & (1 << i)))
+		if (!(state_slot_known & (1 << i)))
+		{
+			sprintf(text_buf, "檢查中 %02i", i + 1);
+		}
+		else if (!(state_slot_flags & (1 << i)))
 		{
 			sprintf(text_buf, "未存檔 %02i", i + 1);
 		}
@@ -1396,8 +2140,7 @@ static void draw_savestate_menu(int menu_sel, int is_loading)
 			}
 		}
 
-		text_out16(listview_x, y, menu_sel_color, text_buf);
-		y += me_mfont_h;
+		text_out16(listview_x, menu_list_row_y(&list, i), menu_sel_color, text_buf);
 	}
 
 	menu_draw_end();
@@ -1407,15 +2150,46 @@ static int menu_loop_savestate(int is_loading)
 {
 	static int menu_sel = 0;
 	int menu_sel_max = STATE_SLOT_COUNT - 1;
+	int drawn_sel = -1, idle = 0, prefetched = 0;
 	unsigned long inp = 0;
-	int ret = 0;
+	int ret = 0, slot, timeout;
 
-	state_check_slots();
+	state_check_slots_start(menu_sel);
+	state_thumbs_init();
 
 	for (;;)
 	{
-		draw_savestate_menu(menu_sel, is_loading);
-		inp = in_menu_wait(PBTN_UP | PBTN_DOWN | PBTN_MOK | PBTN_MBACK, NULL, 100);
+		if (state_check_slots_collect())
+			drawn_sel = -1;
+
+		// only the selection, slot state and previews change while in here
+		if (menu_sel != drawn_sel)
+		{
+			state_thumb_show(menu_sel);
+			draw_savestate_menu(menu_sel, is_loading);
+			drawn_sel = menu_sel;
+		}
+
+		// once input stops, make previews one at a time until there's more
+		timeout = -1;
+		if (state_probe_running)
+			timeout = 50; // slots are still being checked
+		else if (!prefetched)
+		{
+			timeout = 50;
+			if (idle)
+			{
+				slot = state_thumb_prefetch(menu_sel);
+				if (slot == menu_sel)
+					drawn_sel = -1;
+				prefetched = slot < 0;
+				timeout = 0;
+			}
+		}
+		inp = in_menu_wait_timeout(PBTN_UP | PBTN_DOWN | PBTN_MOK | PBTN_MBACK, NULL, 100, timeout);
+		idle = inp == 0;
+		if (inp & (PBTN_UP | PBTN_DOWN))
+			prefetched = 0;
 		if (inp & PBTN_UP)
 		{
 			menu_sel--;
@@ -1430,6 +2204,7 @@ static int menu_loop_savestate(int is_loading)
 		}
 		if (inp & PBTN_MOK)
 		{ // save/load
+			state_check_slots_finish();
 			if (menu_sel < STATE_SLOT_COUNT)
 			{
 				if (!is_loading || (state_slot_flags & (1 << menu_sel)))
@@ -1440,15 +2215,30 @@ static int menu_loop_savestate(int is_loading)
 						menu_update_msg(is_loading ? "Load failed" : "Save failed");
 						break;
 					}
+					if (!is_loading)
+					{
+						// until the next check confirms it
+						state_slot_flags |= 1 << menu_sel;
+						state_slot_known |= 1 << menu_sel;
+						state_slot_times[menu_sel] = time(NULL);
+					}
 					ret = 1;
 					break;
 				}
 			}
+			drawn_sel = -1; // slot state may have changed
 		}
 		if (inp & PBTN_MBACK)
 			break;
 	}
 
+	state_check_slots_finish();
+
+	// prefetching may have left some other slot's preview there
+	if (state_thumb_base != NULL)
+		memcpy(g_menubg_ptr, state_thumb_base, g_menuscreen_w * g_menuscreen_h * MENU_BYPP);
+	menu_bg_changed();
+	state_thumbs_free();
 	return ret;
 }
 
@@ -1551,8 +2341,7 @@ static void draw_key_config(const me_bind_action *opts, int opt_cnt, int player_
 		sprintf(text_buf, "玩家%i按鍵設置", player_idx + 1);
 	else
 		strcpy(text_buf, "快捷鍵設置");
-	wt = 0;
-	TTF_SizeUTF8(me_mfont, text_buf, &wt, NULL);
+	wt = fontcache_text_width(me_mfont_cache, text_buf);
 	title_x = (g_menuscreen_w - wt) / 2;
 	title_y = 5;
 	text_out16(title_x, title_y, menu_sel_color, text_buf);
@@ -1580,8 +2369,7 @@ static void draw_key_config(const me_bind_action *opts, int opt_cnt, int player_
 
 	for (i = 0; i < opt_cnt; i++)
 	{
-		wt = 0;
-		TTF_SizeUTF8(me_mfont, opts[i].name, &wt, NULL);
+		wt = fontcache_text_width(me_mfont_cache, opts[i].name);
 		if (item_left_w < wt)
 			item_left_w = wt;
 	}
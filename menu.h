@@ -121,6 +121,7 @@ extern void *g_menubg_src_ptr;
 extern int g_menuscreen_w;
 extern int g_menuscreen_h;
 extern int g_menuscreen_pp; // pitch (in pixels)
+extern int g_menuscreen_bpp; // 16 (RGB565, default) or 32 (XRGB8888), g_menubg_ptr too
 extern int g_menubg_src_w;
 extern int g_menubg_src_h;
 extern int g_menubg_src_pp;
@@ -128,6 +129,13 @@ extern int g_menubg_src_pp;
 extern int g_autostateld_opt;
 
 void menu_init_base(void);
+
+/* skin background into g_menubg_ptr in the menu's format, decoded
+ * once and then taken from skin.cache in the skin dir */
+int  menu_load_bg(const char *fname);
+
+/* adds glyphs rasterized since startup to skin.cache, for use on exit */
+void menu_save_skin_cache(void);
 void menu_update_msg(const char *msg);
 int text_out16(int x, int y, unsigned short color, const char *textf, ...);
 
@@ -0,0 +1,260 @@
+/*
+ * bitmap font on-screen text
+ *
+ * This work is licensed under the terms of any of these licenses
+ * (at your option):
+ *  - GNU GPL, version 2 or later.
+ *  - GNU LGPL, version 2.1 or later.
+ *  - MAME license.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+#include "fonts.h"
+#include "osd.h"
+
+#define OSD_ROWS 10	// 8 + outline above and below
+
+/* row masks, bit 15 is the column left of the glyph, row 0 the one above */
+struct osd_glyph {
+	uint16_t fg[OSD_ROWS];
+	uint16_t shadow[OSD_ROWS];
+	uint16_t outline[OSD_ROWS];
+};
+
+static struct osd_glyph osd_glyphs[2][256];
+static const int osd_font_w[2] = { 8, 6 };
+static int osd_ready;
+
+/* 8 mask bits -> 8 pixel masks, leftmost pixel is bit 7 */
+static uint16_t osd_expand16[256][8];
+static uint32_t osd_expand32[256][8];
+
+static void osd_init(void)
+{
+	struct osd_glyph *g;
+	unsigned int bits, ol;
+	int f, c, r, i;
+
+	for (c = 0; c < 256; c++) {
+		for (i = 0; i < 8; i++) {
+			osd_expand16[c][i] = (c & (0x80 >> i)) ? 0xffff : 0;
+			osd_expand32[c][i] = (c & (0x80 >> i)) ? 0xffffffff : 0;
+		}
+	}
+
+	for (f = 0; f < 2; f++) {
+		for (c = 0; c < 256; c++) {
+			g = &osd_glyphs[f][c];
+			memset(g, 0, sizeof(*g));
+			for (r = 0; r < 8; r++) {
+				if (f == OSD_FONT_8X8)
+					bits = c < 128 ? fontdata8x8[c * 8 + r] : 0;
+				else
+					bits = fontdata6x8[c][r] << 2;
+				g->fg[r + 1] = bits << 7;
+			}
+			for (r = 0; r < OSD_ROWS; r++) {
+				ol = g->fg[r];
+				if (r > 0) {
+					ol |= g->fg[r - 1];
+					g->shadow[r] = (g->fg[r - 1] >> 1) & ~g->fg[r];
+				}
+				if (r < OSD_ROWS - 1)
+					ol |= g->fg[r + 1];
+				ol |= (ol << 1) | (ol >> 1);
+				g->outline[r] = ol & ~g->fg[r];
+			}
+		}
+	}
+
+	osd_ready = 1;
+}
+
+/* 16 pixels from d on: bg mask pixels go black, then fg mask gets color */
+static void osd_row16(uint16_t *d, unsigned int fgm, unsigned int bgm, uint16_t color)
+{
+	unsigned int f, b;
+	int i;
+
+	for (i = 0; i < 2; i++, d += 8) {
+		f = (fgm >> (8 - i * 8)) & 0xff;
+		b = (bgm >> (8 - i * 8)) & 0xff;
+		if ((f | b) == 0)
+			continue;
+#if defined(HAVE_NEON)
+		{
+			uint16x8_t p = vld1q_u16(d);
+			p = vbicq_u16(p, vld1q_u16(osd_expand16[b]));
+			p = vbslq_u16(vld1q_u16(osd_expand16[f]), vdupq_n_u16(color), p);
+			vst1q_u16(d, p);
+		}
+#elif defined(HAVE_SSE2)
+		{
+			__m128i p = _mm_loadu_si128((__m128i *)d);
+			__m128i m = _mm_loadu_si128((const __m128i *)osd_expand16[f]);
+			p = _mm_andnot_si128(_mm_loadu_si128((const __m128i *)osd_expand16[b]), p);
+			p = _mm_or_si128(_mm_and_si128(m, _mm_set1_epi16((short)color)),
+				_mm_andnot_si128(m, p));
+			_mm_storeu_si128((__m128i *)d, p);
+		}
+#else
+		{
+			int j;
+			for (j = 0; j < 8; j++) {
+				if (b & (0x80 >> j))
+					d[j] = 0;
+				if (f & (0x80 >> j))
+					d[j] = color;
+			}
+		}
+#endif
+	}
+}
+
+static void osd_row32(uint32_t *d, unsigned int fgm, unsigned int bgm, uint32_t color)
+{
+	unsigned int f, b;
+	int i;
+
+	for (i = 0; i < 2; i++, d += 8) {
+		f = (fgm >> (8 - i * 8)) & 0xff;
+		b = (bgm >> (8 - i * 8)) & 0xff;
+		if ((f | b) == 0)
+			continue;
+#if defined(HAVE_NEON)
+		{
+			uint32x4_t c = vdupq_n_u32(color);
+			uint32x4_t p0 = vld1q_u32(d), p1 = vld1q_u32(d + 4);
+			p0 = vbicq_u32(p0, vld1q_u32(osd_expand32[b]));
+			p1 = vbicq_u32(p1, vld1q_u32(osd_expand32[b] + 4));
+			p0 = vbslq_u32(vld1q_u32(osd_expand32[f]), c, p0);
+			p1 = vbslq_u32(vld1q_u32(osd_expand32[f] + 4), c, p1);
+			vst1q_u32(d, p0);
+			vst1q_u32(d + 4, p1);
+		}
+#elif defined(HAVE_SSE2)
+		{
+			__m128i c = _mm_set1_epi32((int)color);
+			__m128i p0 = _mm_loadu_si128((__m128i *)d);
+			__m128i p1 = _mm_loadu_si128((__m128i *)d + 1);
+			__m128i m0 = _mm_loadu_si128((const __m128i *)osd_expand32[f]);
+			__m128i m1 = _mm_loadu_si128((const __m128i *)osd_expand32[f] + 1);
+			p0 = _mm_andnot_si128(_mm_loadu_si128((const __m128i *)osd_expand32[b]), p0);
+			p1 = _mm_andnot_si128(_mm_loadu_si128((const __m128i *)osd_expand32[b] + 1), p1);
+			p0 = _mm_or_si128(_mm_and_si128(m0, c), _mm_andnot_si128(m0, p0));
+			p1 = _mm_or_si128(_mm_and_si128(m1, c), _mm_andnot_si128(m1, p1));
+			_mm_storeu_si128((__m128i *)d, p0);
+			_mm_storeu_si128((__m128i *)d + 1, p1);
+		}
+#else
+		{
+			int j;
+			for (j = 0; j < 8; j++) {
+				if (b & (0x80 >> j))
+					d[j] = 0;
+				if (f & (0x80 >> j))
+					d[j] = color;
+			}
+		}
+#endif
+	}
+}
+
+static int osd_text_out(void *fb, int w, int h, int pitch, int x, int y,
+	int font, int flags, unsigned int color, const char *text, int bpp)
+{
+	const struct osd_glyph *g;
+	const unsigned char *p;
+	unsigned int fgm, bgm;
+	int cw, r, i, px, py, cx, fast, pass;
+	char *line;
+
+	if (!osd_ready)
+		osd_init();
+
+	font = font == OSD_FONT_6X8 ? OSD_FONT_6X8 : OSD_FONT_8X8;
+	cw = osd_font_w[font];
+
+	// shadow/outline of the whole line first, so it never covers a neighbour
+	for (pass = (flags & (OSD_SHADOW | OSD_OUTLINE)) ? 0 : 1; pass < 2; pass++)
+	for (p = (const unsigned char *)text, cx = x; *p != 0; p++, cx += cw) {
+		if (*p == ' ')
+			continue;
+		if (cx + cw + 1 <= 0 || cx - 1 >= w)
+			continue;
+		g = &osd_glyphs[font][*p];
+
+		// row ops touch 16 pixels from cx - 1 on, take care near edges
+		fast = cx - 1 >= 0 && cx + 15 <= w && y - 1 >= 0 && y + 9 <= h;
+
+		for (r = 0; r < OSD_ROWS; r++) {
+			fgm = bgm = 0;
+			if (pass == 1)
+				fgm = g->fg[r];
+			else {
+				if (flags & OSD_SHADOW)
+					bgm |= g->shadow[r];
+				if (flags & OSD_OUTLINE)
+					bgm |= g->outline[r];
+			}
+			if ((fgm | bgm) == 0)
+				continue;
+
+			py = y - 1 + r;
+			if (!fast && (py < 0 || py >= h))
+				continue;
+			line = (char *)fb + py * pitch;
+
+			if (fast) {
+				if (bpp == 16)
+					osd_row16((uint16_t *)line + cx - 1, fgm, bgm, color);
+				else
+					osd_row32((uint32_t *)line + cx - 1, fgm, bgm, color);
+				continue;
+			}
+
+			for (i = 0; i < 16; i++) {
+				unsigned int bit = 0x8000 >> i;
+				if (!((fgm | bgm) & bit))
+					continue;
+				px = cx - 1 + i;
+				if (px < 0 || px >= w)
+					continue;
+				if (bpp == 16)
+					((uint16_t *)line)[px] = (fgm & bit) ? color : 0;
+				else
+					((uint32_t *)line)[px] = (fgm & bit) ? color : 0;
+			}
+		}
+	}
+
+	return (int)strlen(text) * cw;
+}
+
+int osd_text_out16(void *fb, int w, int h, int pitch, int x, int y,
+	int font, int flags, unsigned short color, const char *text)
+{
+	return osd_text_out(fb, w, h, pitch, x, y, font, flags, color, text, 16);
+}
+
+int osd_text_out32(void *fb, int w, int h, int pitch, int x, int y,
+	int font, int flags, unsigned int color, const char *text)
+{
+	return osd_text_out(fb, w, h, pitch, x, y, font, flags, color, text, 32);
+}
+
+int osd_text_width(int font, const char *text)
+{
+	return strlen(text) * osd_font_w[font == OSD_FONT_6X8 ? 1 : 0];
+}
@@ -0,0 +1,23 @@
+#ifndef LIBPICOFE_OSD_H
+#define LIBPICOFE_OSD_H
+
+/* On-screen text with the built-in bitmap fonts, for things drawn over
+ * the game every frame (fps, messages). Each glyph row is a bit mask
+ * that is expanded to whole pixels with a table lookup, so a row is a
+ * couple of vector selects. Text is clipped to w x h, pitch is in bytes. */
+
+#define OSD_FONT_8X8 0	// fontdata8x8, ASCII only
+#define OSD_FONT_6X8 1	// fontdata6x8
+
+#define OSD_SHADOW  (1 << 0)	// black, one pixel down and right
+#define OSD_OUTLINE (1 << 1)	// black, all around
+
+/* both return the text width */
+int osd_text_out16(void *fb, int w, int h, int pitch, int x, int y,
+		int font, int flags, unsigned short color, const char *text);
+int osd_text_out32(void *fb, int w, int h, int pitch, int x, int y,
+		int font, int flags, unsigned int color, const char *text);
+
+int osd_text_width(int font, const char *text);
+
+#endif // LIBPICOFE_OSD_H
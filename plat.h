@@ -112,6 +112,17 @@ int  plat_get_data_dir(char *dst, int len);
 
 int  plat_is_dir(const char *path);
 int  plat_wait_event(int *fds_hnds, int count, int timeout_ms);
+
+/* persistent wait set: handles are added once, then a wait reports all
+ * ready ones (up to max) and returns their count, 0 on timeout or
+ * wakeup, -1 on error. plat_wait_wakeup() may be called from any
+ * thread to end a wait early.
+ * input.c needs these. linux/plat.c has them, other platforms can
+ * link plat_wait.c, which builds them on plat_wait_event(). */
+int  plat_wait_add(int fd_hnd);
+void plat_wait_remove(int fd_hnd);
+int  plat_wait_events(int *ready, int max, int timeout_ms);
+void plat_wait_wakeup(void);
 void plat_sleep_ms(int ms);
 
 void *plat_mmap(unsigned long addr, size_t size, int need_exec, int is_fixed);
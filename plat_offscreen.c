@@ -0,0 +1,215 @@
+/*
+ * headless video output
+ *
+ * This work is licensed under the terms of any of these licenses
+ * (at your option):
+ *  - GNU GPL, version 2 or later.
+ *  - GNU LGPL, version 2.1 or later.
+ *  - MAME license.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "menu.h"
+#include "plat.h"
+#include "fastmem.h"
+#include "screenshot.h"
+#include "framedump.h"
+#include "plat_offscreen.h"
+
+void *plat_offscreen_fb;
+int plat_offscreen_w;
+int plat_offscreen_h;
+int plat_offscreen_bpp;
+int plat_offscreen_pitch;
+
+static int offscreen_flags;
+static char dump_dir[256];
+static int dump_every = 1;
+static struct plat_offscreen_stats stats;
+static unsigned int last_flip_us;
+static void *menu_buf;
+static void *menubg_buf;	/* g_menubg_ptr, if we had to provide it */
+
+static void offscreen_frame_done(const void *buf, int w, int h, int bpp, int pitch)
+{
+	unsigned int now = plat_get_ticks_us();
+	char fname[300];
+
+	if (stats.frames + stats.menu_frames > 0) {
+		unsigned int diff = now - last_flip_us;
+		if (diff < stats.min_us)
+			stats.min_us = diff;
+		if (diff > stats.max_us)
+			stats.max_us = diff;
+		stats.total_us += diff;
+	}
+	last_flip_us = now;
+
+	framedump_frame(buf, w, h, bpp, pitch);
+
+	if (offscreen_flags & OFFSCREEN_CHECKSUM) {
+		const char *p = buf;
+		unsigned long long hash = 0;
+		int y;
+
+		for (y = 0; y < h; y++, p += pitch)
+			hash = hash * 31 + fastmem_hash(p, w * bpp / 8);
+		stats.last_hash = hash;
+	}
+
+	// written in the background, waits only if the writer falls behind
+	if ((offscreen_flags & OFFSCREEN_DUMP) && dump_dir[0] != 0
+	    && (stats.frames + stats.menu_frames) % dump_every == 0)
+	{
+		snprintf(fname, sizeof(fname), "%s/frame%06u.png", dump_dir,
+			stats.frames + stats.menu_frames);
+		screenshot_save(fname, buf, w, h, bpp, pitch, SCREENSHOT_WAIT, NULL, NULL);
+	}
+}
+
+void plat_video_flip(void)
+{
+	offscreen_frame_done(plat_offscreen_fb, plat_offscreen_w, plat_offscreen_h,
+		plat_offscreen_bpp, plat_offscreen_pitch);
+	stats.frames++;
+}
+
+void plat_video_wait_vsync(void)
+{
+}
+
+void plat_video_menu_enter(int is_rom_loaded)
+{
+	g_menubg_src_ptr = NULL;
+	if (is_rom_loaded && plat_offscreen_bpp == g_menuscreen_bpp) {
+		g_menubg_src_ptr = plat_offscreen_fb;
+		g_menubg_src_w = plat_offscreen_w;
+		g_menubg_src_h = plat_offscreen_h;
+		g_menubg_src_pp = plat_offscreen_pitch / (plat_offscreen_bpp / 8);
+	}
+}
+
+void plat_video_menu_begin(void)
+{
+}
+
+void plat_video_menu_end(void)
+{
+	offscreen_frame_done(g_menuscreen_surface->pixels, g_menuscreen_w,
+		g_menuscreen_h, g_menuscreen_bpp, g_menuscreen_surface->pitch);
+	stats.menu_frames++;
+}
+
+void plat_video_menu_leave(void)
+{
+}
+
+int plat_offscreen_change_video_mode(int w, int h, int bpp)
+{
+	int pitch = w * bpp / 8;
+	void *tmp;
+
+	if (bpp != 16 && bpp != 32) {
+		fprintf(stderr, "offscreen: unsupported bpp %d\n", bpp);
+		return -1;
+	}
+
+	tmp = realloc(plat_offscreen_fb, pitch * h);
+	if (tmp == NULL) {
+		fprintf(stderr, "offscreen: OOM\n");
+		return -1;
+	}
+	memset(tmp, 0, pitch * h);
+
+	plat_offscreen_fb = tmp;
+	plat_offscreen_w = w;
+	plat_offscreen_h = h;
+	plat_offscreen_bpp = bpp;
+	plat_offscreen_pitch = pitch;
+
+	return 0;
+}
+
+void plat_offscreen_set_dump(const char *dir, int every)
+{
+	snprintf(dump_dir, sizeof(dump_dir), "%s", dir ? dir : "");
+	dump_every = every > 0 ? every : 1;
+	if (dump_dir[0] != 0)
+		screenshot_init(0, 1, 0); // fast zlib level, dumps can be many
+}
+
+void plat_offscreen_get_stats(struct plat_offscreen_stats *stats_out)
+{
+	*stats_out = stats;
+}
+
+void plat_offscreen_reset_stats(void)
+{
+	memset(&stats, 0, sizeof(stats));
+	stats.min_us = ~0;
+}
+
+int plat_offscreen_init(int w, int h, int bpp, int flags)
+{
+	offscreen_flags = flags;
+	plat_offscreen_reset_stats();
+
+	if (plat_offscreen_change_video_mode(w, h, bpp) != 0)
+		return -1;
+
+	// the menu uses the same size and format as the "screen"
+	g_menuscreen_w = w;
+	g_menuscreen_h = h;
+	g_menuscreen_pp = w;
+	g_menuscreen_bpp = bpp;
+	menu_buf = calloc(w * h, bpp / 8);
+	if (menu_buf == NULL)
+		goto fail;
+	// the frontend's own background buffer is left alone
+	if (g_menubg_ptr == NULL) {
+		g_menubg_ptr = menubg_buf = calloc(w * h, bpp / 8);
+		if (menubg_buf == NULL)
+			goto fail;
+	}
+
+	// software surface, needs no video init
+	if (bpp == 32)
+		g_menuscreen_surface = SDL_CreateRGBSurfaceFrom(menu_buf, w, h, 32, w * 4,
+			0xff0000, 0x00ff00, 0x0000ff, 0);
+	else
+		g_menuscreen_surface = SDL_CreateRGBSurfaceFrom(menu_buf, w, h, 16, w * 2,
+			0xf800, 0x07e0, 0x001f, 0);
+	if (g_menuscreen_surface == NULL) {
+		fprintf(stderr, "offscreen: SDL_CreateRGBSurfaceFrom: %s\n", SDL_GetError());
+		goto fail;
+	}
+
+	printf("offscreen: %dx%d@%d\n", w, h, bpp);
+	return 0;
+
+fail:
+	plat_offscreen_finish();
+	return -1;
+}
+
+void plat_offscreen_finish(void)
+{
+	screenshot_finish();
+	framedump_stop();
+	if (g_menuscreen_surface != NULL)
+		SDL_FreeSurface(g_menuscreen_surface);
+	g_menuscreen_surface = NULL;
+	free(menu_buf);
+	menu_buf = NULL;
+	if (menubg_buf != NULL && g_menubg_ptr == menubg_buf)
+		g_menubg_ptr = NULL;
+	free(menubg_buf);
+	menubg_buf = NULL;
+	free(plat_offscreen_fb);
+	plat_offscreen_fb = NULL;
+}
@@ -0,0 +1,34 @@
+#ifndef LIBPICOFE_PLAT_OFFSCREEN_H
+#define LIBPICOFE_PLAT_OFFSCREEN_H
+
+/* headless video output, frames go to memory only.
+ * Provides plat_video_* and the menu surfaces, for running the
+ * whole frontend loop without a display (benchmarks, tests). */
+
+#define OFFSCREEN_CHECKSUM	(1 << 0)	/* hash every flipped frame */
+#define OFFSCREEN_DUMP		(1 << 1)	/* write every dump_every'th frame as png */
+
+struct plat_offscreen_stats {
+	unsigned int frames;
+	unsigned int menu_frames;
+	unsigned long long last_hash;	/* of last flipped frame */
+	unsigned int min_us;		/* flip to flip interval */
+	unsigned int max_us;
+	unsigned long long total_us;
+};
+
+/* emulator frame buffer, render here and call plat_video_flip() */
+extern void *plat_offscreen_fb;
+extern int plat_offscreen_w;
+extern int plat_offscreen_h;
+extern int plat_offscreen_bpp;
+extern int plat_offscreen_pitch;	/* in bytes */
+
+int  plat_offscreen_init(int w, int h, int bpp, int flags);
+int  plat_offscreen_change_video_mode(int w, int h, int bpp);
+void plat_offscreen_set_dump(const char *dir, int every);
+void plat_offscreen_get_stats(struct plat_offscreen_stats *stats);
+void plat_offscreen_reset_stats(void);
+void plat_offscreen_finish(void);
+
+#endif // LIBPICOFE_PLAT_OFFSCREEN_H
@@ -17,6 +17,7 @@
 #include "plat.h"
 #include "gl.h"
 #include "plat_sdl.h"
+#include "fastmem.h"
 
 // XXX: maybe determine this instead..
 #define WM_DECORATION_H 32
@@ -323,14 +324,9 @@ void plat_sdl_finish(void)
 void plat_sdl_overlay_clear(void)
 {
   int pixels = plat_sdl_overlay->w * plat_sdl_overlay->h;
-  int *dst = (int *)plat_sdl_overlay->pixels[0];
-  int v = 0x10801080;
 
-  for (; pixels > 0; dst += 4, pixels -= 2 * 4)
-    dst[0] = dst[1] = dst[2] = dst[3] = v;
-
-  for (; pixels > 0; dst++, pixels -= 2)
-    *dst = v;
+  // UYVY black, 2 pixels per word
+  fastmem_fill32(plat_sdl_overlay->pixels[0], 0x10801080, (pixels + 1) / 2);
 }
 
 // vim:shiftwidth=2:expandtab
@@ -0,0 +1,92 @@
+/*
+ * generic plat_wait_add/remove/events/wakeup on top of plat_wait_event(),
+ * for platforms without a native wait set (linux/plat.c has one)
+ *
+ * This work is licensed under the terms of any of these licenses
+ * (at your option):
+ *  - GNU GPL, version 2 or later.
+ *  - GNU LGPL, version 2.1 or later.
+ *  - MAME license.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include "plat.h"
+
+#define WAIT_MAX_HNDS 64
+#define WAIT_SLICE_MS 10	/* how late a wakeup can be noticed */
+
+static int wait_hnds[WAIT_MAX_HNDS];
+static int wait_count;
+static volatile int wait_woken;
+
+int plat_wait_add(int fd_hnd)
+{
+	int i;
+
+	for (i = 0; i < wait_count; i++)
+		if (wait_hnds[i] == fd_hnd)
+			return 0;
+
+	if (wait_count >= WAIT_MAX_HNDS) {
+		fprintf(stderr, "plat_wait_add: too many handles\n");
+		return -1;
+	}
+	wait_hnds[wait_count++] = fd_hnd;
+
+	return 0;
+}
+
+void plat_wait_remove(int fd_hnd)
+{
+	int i;
+
+	for (i = 0; i < wait_count; i++) {
+		if (wait_hnds[i] == fd_hnd) {
+			wait_hnds[i] = wait_hnds[--wait_count];
+			break;
+		}
+	}
+}
+
+/* plat_wait_event() reports one handle, so at most 1 is returned */
+int plat_wait_events(int *ready, int max, int timeout_ms)
+{
+	unsigned int ticks = plat_get_ticks_ms();
+	int hnd, left = 0, slice;
+
+	if (max < 1)
+		return -1;
+
+	while (1) {
+		if (__sync_fetch_and_and(&wait_woken, 0))
+			return 0;
+
+		slice = WAIT_SLICE_MS;
+		if (timeout_ms >= 0) {
+			left = timeout_ms - (int)(plat_get_ticks_ms() - ticks);
+			if (left < 0)
+				left = 0;
+			if (slice > left)
+				slice = left;
+		}
+
+		if (wait_count == 0)
+			plat_sleep_ms(slice);
+		else {
+			hnd = plat_wait_event(wait_hnds, wait_count, slice);
+			if (hnd != -1) {
+				ready[0] = hnd;
+				return 1;
+			}
+		}
+
+		if (timeout_ms >= 0 && slice == left)
+			return 0;
+	}
+}
+
+void plat_wait_wakeup(void)
+{
+	__sync_fetch_and_or(&wait_woken, 1);
+}
@@ -16,12 +16,87 @@
 #include "readpng.h"
 #include "lprintf.h"
 
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+/* the 2nd green bit is dropped, as it always was */
+static void rgb888_to_565(unsigned short *dst, const unsigned char *src, int count)
+{
+#if defined(HAVE_NEON)
+	for (; count >= 8; count -= 8, src += 24, dst += 8) {
+		uint8x8x3_t p = vld3_u8(src);
+		uint8x8_t m = vdup_n_u8(0xf8);
+		uint16x8_t d = vshll_n_u8(vand_u8(p.val[0], m), 8);
+		d = vorrq_u16(d, vshll_n_u8(vand_u8(p.val[1], m), 3));
+		d = vorrq_u16(d, vmovl_u8(vshr_n_u8(p.val[2], 3)));
+		vst1q_u16(dst, d);
+	}
+#elif defined(HAVE_SSE2)
+	// 16 byte loads of 12 byte groups, keep 2 pixels of slack at the end
+	const __m128i l0 = _mm_set_epi32(0, 0, 0, -1), l1 = _mm_slli_si128(l0, 4);
+	const __m128i l2 = _mm_slli_si128(l0, 8), l3 = _mm_slli_si128(l0, 12);
+	const __m128i mr = _mm_set1_epi32(0xf8), mg = _mm_set1_epi32(0xf800);
+	__m128i v[2];
+	int i;
+
+	for (; count >= 10; count -= 8, src += 24, dst += 8) {
+		for (i = 0; i < 2; i++) {
+			__m128i x = _mm_loadu_si128((const __m128i *)(src + i * 12));
+			// pixel n to 32bit lane n, R in the low byte
+			x = _mm_or_si128(_mm_or_si128(_mm_and_si128(x, l0),
+				_mm_and_si128(_mm_slli_si128(x, 1), l1)),
+				_mm_or_si128(_mm_and_si128(_mm_slli_si128(x, 2), l2),
+				_mm_and_si128(_mm_slli_si128(x, 3), l3)));
+			x = _mm_or_si128(_mm_or_si128(
+				_mm_slli_epi32(_mm_and_si128(x, mr), 8),
+				_mm_srli_epi32(_mm_and_si128(x, mg), 5)),
+				_mm_and_si128(_mm_srli_epi32(x, 19), _mm_set1_epi32(0x1f)));
+			// sign extend so that the signed pack keeps all 16 bits
+			v[i] = _mm_srai_epi32(_mm_slli_epi32(x, 16), 16);
+		}
+		_mm_storeu_si128((__m128i *)dst, _mm_packs_epi32(v[0], v[1]));
+	}
+#endif
+	for (; count > 0; count--, src += 3) {
+#ifdef PSP
+		*dst++ = ((src[2]&0xf8)<<8) | ((src[1]&0xf8)<<3) | (src[0] >> 3); // BGR
+#else
+		*dst++ = ((src[0]&0xf8)<<8) | ((src[1]&0xf8)<<3) | (src[2] >> 3); // RGB
+#endif
+	}
+}
+
+struct png_rows {
+	png_structp png_ptr;
+	png_bytep row;		// the last row read
+	png_bytepp all;		// whole image, interlaced files only
+	int next;
+};
+
+/* rows must be asked for top to bottom */
+static png_bytep get_row(struct png_rows *r, int y)
+{
+	if (r->all != NULL)
+		return r->all[y];
+	for (; r->next <= y; r->next++)
+		png_read_row(r->png_ptr, r->row, NULL);
+	return r->row;
+}
+
 int readpng(void *dest, const char *fname, readpng_what what, int req_w, int req_h)
 {
 	FILE *fp;
 	png_structp png_ptr = NULL;
 	png_infop info_ptr = NULL;
-	png_bytepp row_ptr = NULL;
+	void * volatile row_mem = NULL;
+	struct png_rows rows;
+	size_t rowbytes;
+	int img_w, img_h, bit_depth, passes, y;
 	int ret = -1;
 
 	if (dest == NULL || fname == NULL)
@@ -51,56 +126,87 @@ int readpng(void *dest, const char *fname, readpng_what what, int req_w, int req
 		goto done;
 	}
 
-	// Start reading
-	png_init_io(png_ptr, fp);
-	png_read_png(png_ptr, info_ptr, PNG_TRANSFORM_STRIP_16 | PNG_TRANSFORM_STRIP_ALPHA | PNG_TRANSFORM_PACKING, NULL);
-	row_ptr = png_get_rows(png_ptr, info_ptr);
-	if (row_ptr == NULL)
+	if (setjmp(png_jmpbuf(png_ptr)) != 0)
 	{
-		lprintf(__FILE__ ": png_get_rows() failed\n");
+		lprintf(__FILE__ ": error decoding %s\n", fname);
+		ret = -1;
 		goto done;
 	}
 
-	// lprintf("%s: %ix%i @ %ibpp\n", fname, (int)png_get_image_width(png_ptr, info_ptr),
-	// 	(int)png_get_image_height(png_ptr, info_ptr), png_get_bit_depth(png_ptr, info_ptr));
+	// Start reading, same transforms png_read_png() was given before
+	png_init_io(png_ptr, fp);
+	png_read_info(png_ptr, info_ptr);
+	png_set_strip_16(png_ptr);
+	png_set_strip_alpha(png_ptr);
+	png_set_packing(png_ptr);
+	passes = png_set_interlace_handling(png_ptr);
+	png_read_update_info(png_ptr, info_ptr);
+
+	img_w = png_get_image_width(png_ptr, info_ptr);
+	img_h = png_get_image_height(png_ptr, info_ptr);
+	bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+	rowbytes = png_get_rowbytes(png_ptr, info_ptr);
+
+	// decode one row at a time into a single buffer, converting as we go;
+	// interlaced images can only be had whole
+	memset(&rows, 0, sizeof(rows));
+	rows.png_ptr = png_ptr;
+	if (passes > 1) {
+		rows.all = row_mem = malloc(img_h * (sizeof(rows.all[0]) + rowbytes));
+		if (rows.all == NULL)
+			goto oom;
+		for (y = 0; y < img_h; y++)
+			rows.all[y] = (png_bytep)(rows.all + img_h) + y * rowbytes;
+		png_read_image(png_ptr, rows.all);
+	}
+	else {
+		rows.row = row_mem = malloc(rowbytes);
+		if (rows.row == NULL)
+			goto oom;
+	}
+
+	// lprintf("%s: %ix%i @ %ibpp\n", fname, img_w, img_h, bit_depth);
 
 	switch (what)
 	{
 		case READPNG_BG:
+		case READPNG_BG32:
 		{
 			int height, width, h, x_ofs = 0, y_ofs = 0;
-			unsigned short *dst = dest;
 
-			if (png_get_bit_depth(png_ptr, info_ptr) != 8)
+			if (bit_depth != 8)
 			{
-				lprintf(__FILE__ ": bg image uses %ibpc, needed 8bpc\n", png_get_bit_depth(png_ptr, info_ptr));
+				lprintf(__FILE__ ": bg image uses %ibpc, needed 8bpc\n", bit_depth);
 				break;
 			}
-			width = png_get_image_width(png_ptr, info_ptr);
+			width = img_w;
 			if (width > req_w) {
 				x_ofs = (width - req_w) / 2;
 				width = req_w;
 			}
-			height = png_get_image_height(png_ptr, info_ptr);
+			height = img_h;
 			if (height > req_h) {
 				y_ofs = (height - req_h) / 2;
 				height = req_h;
 			}
 
+			// rows above the crop are decoded but not converted,
+			// the ones below are never decoded
 			for (h = 0; h < height; h++)
 			{
-				unsigned char *src = row_ptr[h + y_ofs] + x_ofs * 3;
-				int len = width;
-				while (len--)
-				{
-#ifdef PSP
-					*dst++ = ((src[2]&0xf8)<<8) | ((src[1]&0xf8)<<3) | (src[0] >> 3); // BGR
-#else
-					*dst++ = ((src[0]&0xf8)<<8) | ((src[1]&0xf8)<<3) | (src[2] >> 3); // RGB
-#endif
-					src += 3;
+				unsigned char *src = get_row(&rows, h + y_ofs) + x_ofs * 3;
+				if (what == READPNG_BG) {
+					rgb888_to_565((unsigned short *)dest + h * req_w, src, width);
+				}
+				else {
+					unsigned int *dst = (unsigned int *)dest + h * req_w;
+					int len = width;
+					while (len--)
+					{
+						*dst++ = (src[0] << 16) | (src[1] << 8) | src[2];
+						src += 3;
+					}
 				}
-				dst += req_w - width;
 			}
 			break;
 		}
@@ -108,28 +214,30 @@ int readpng(void *dest, const char *fname, readpng_what what, int req_w, int req
 		case READPNG_FONT:
 		{
 			int x, y, x1, y1;
-			unsigned char *dst = dest;
-			if (png_get_image_width(png_ptr, info_ptr) != req_w || png_get_image_height(png_ptr, info_ptr) != req_h)
+			if (img_w != req_w || img_h != req_h)
 			{
 				lprintf(__FILE__ ": unexpected font image size %dx%d, needed %dx%d\n",
-					(int)png_get_image_width(png_ptr, info_ptr), (int)png_get_image_height(png_ptr, info_ptr), req_w, req_h);
+					img_w, img_h, req_w, req_h);
 				break;
 			}
-			if (png_get_bit_depth(png_ptr, info_ptr) != 8)
+			if (bit_depth != 8)
 			{
-				lprintf(__FILE__ ": font image uses %ibpp, needed 8bpp\n", png_get_bit_depth(png_ptr, info_ptr));
+				lprintf(__FILE__ ": font image uses %ibpp, needed 8bpp\n", bit_depth);
 				break;
 			}
 			for (y = 0; y < 16; y++)
 			{
-				for (x = 0; x < 16; x++)
+				/* 16x16 grid of syms */
+				int sym_w = req_w / 16;
+				int sym_h = req_h / 16;
+				for (y1 = 0; y1 < sym_h; y1++)
 				{
-					/* 16x16 grid of syms */
-					int sym_w = req_w / 16;
-					int sym_h = req_h / 16;
-					for (y1 = 0; y1 < sym_h; y1++)
+					unsigned char *row = get_row(&rows, y*sym_h + y1);
+					for (x = 0; x < 16; x++)
 					{
-						unsigned char *src = row_ptr[y*sym_h + y1] + x*sym_w;
+						unsigned char *dst = (unsigned char *)dest
+							+ ((y*16 + x) * sym_h + y1) * (sym_w/2);
+						unsigned char *src = row + x*sym_w;
 						for (x1 = sym_w/2; x1 > 0; x1--, src+=2)
 							*dst++ = ((src[0]^0xff) & 0xf0) | ((src[1]^0xff) >> 4);
 					}
@@ -142,20 +250,20 @@ int readpng(void *dest, const char *fname, readpng_what what, int req_w, int req
 		{
 			int x1, y1;
 			unsigned char *dst = dest;
-			if (png_get_image_width(png_ptr, info_ptr) != req_w || png_get_image_height(png_ptr, info_ptr) != req_h)
+			if (img_w != req_w || img_h != req_h)
 			{
 				lprintf(__FILE__ ": unexpected selector image size %ix%i, needed %dx%d\n",
-					(int)png_get_image_width(png_ptr, info_ptr), (int)png_get_image_height(png_ptr, info_ptr), req_w, req_h);
+					img_w, img_h, req_w, req_h);
 				break;
 			}
-			if (png_get_bit_depth(png_ptr, info_ptr) != 8)
+			if (bit_depth != 8)
 			{
-				lprintf(__FILE__ ": selector image uses %ibpp, needed 8bpp\n", png_get_bit_depth(png_ptr, info_ptr));
+				lprintf(__FILE__ ": selector image uses %ibpp, needed 8bpp\n", bit_depth);
 				break;
 			}
 			for (y1 = 0; y1 < req_h; y1++)
 			{
-				unsigned char *src = row_ptr[y1];
+				unsigned char *src = get_row(&rows, y1);
 				for (x1 = req_w/2; x1 > 0; x1--, src+=2)
 					*dst++ = ((src[0]^0xff) & 0xf0) | ((src[1]^0xff) >> 4);
 			}
@@ -166,22 +274,22 @@ int readpng(void *dest, const char *fname, readpng_what what, int req_w, int req
 		{
 			int height, width, h;
 			unsigned char *dst = dest;
-			if (png_get_bit_depth(png_ptr, info_ptr) != 8)
+			if (bit_depth != 8)
 			{
-				lprintf(__FILE__ ": image uses %ibpc, needed 8bpc\n", png_get_bit_depth(png_ptr, info_ptr));
+				lprintf(__FILE__ ": image uses %ibpc, needed 8bpc\n", bit_depth);
 				break;
 			}
-			width = png_get_image_width(png_ptr, info_ptr);
+			width = img_w;
 			if (width > req_w)
 				width = req_w;
-			height = png_get_image_height(png_ptr, info_ptr);
+			height = img_h;
 			if (height > req_h)
 				height = req_h;
 
 			for (h = 0; h < height; h++)
 			{
 				int len = width;
-				unsigned char *src = row_ptr[h];
+				unsigned char *src = get_row(&rows, h);
 				dst += (req_w - width) * 3;
 				for (len = width; len > 0; len--, dst+=3, src+=3)
 					dst[0] = src[2], dst[1] = src[1], dst[2] = src[0];
@@ -190,84 +298,107 @@ int readpng(void *dest, const char *fname, readpng_what what, int req_w, int req
 		}
 	}
 
-
+	// the rest of the file is left unread, nothing in it is needed
 	ret = 0;
+	goto done;
+
+oom:
+	lprintf(__FILE__ ": OOM decoding %s\n", fname);
 done:
 	png_destroy_read_struct(&png_ptr, info_ptr ? &info_ptr : NULL, (png_infopp)NULL);
+	free(row_mem);
 	fclose(fp);
 	return ret;
 }
 
 int writepng(const char *fname, unsigned short *src, int w, int h)
+{
+	return writepng_ex(fname, src, w, h, 16, w * 2, -1, 0);
+}
+
+int writepng_ex(const char *fname, const void *src, int w, int h, int bpp,
+	int pitch, int level, int filters)
 {
 	png_structp png_ptr = NULL;
 	png_infop info_ptr = NULL;
-	png_bytepp row_pointers;
-	int i, j, ret = -1;
+	unsigned char * volatile row = NULL;
+	int x, y, ret = -1;
 	FILE *f;
 
+	if (bpp != 16 && bpp != 32) {
+		lprintf(__FILE__ ": can't write %dbpp\n", bpp);
+		return -1;
+	}
+
 	f = fopen(fname, "wb");
 	if (f == NULL) {
 		lprintf(__FILE__ ": failed to open \"%s\"\n", fname);
 		return -1;
 	}
 
-	row_pointers = calloc(h, sizeof(row_pointers[0]));
-	if (row_pointers == NULL)
+	// converted and written one row at a time
+	row = malloc(w * 3);
+	if (row == NULL)
 		goto end1;
 
-	for (i = 0; i < h; i++) {
-		unsigned char *dst = malloc(w * 3);
-		if (dst == NULL)
-			goto end2;
-		row_pointers[i] = dst;
-		for (j = 0; j < w; j++, src++, dst += 3) {
-			dst[0] = (*src & 0xf800) >> 8;
-			dst[1] = (*src & 0x07e0) >> 3;
-			dst[2] = (*src & 0x001f) << 3;
-		}
-	}
-
 	/* initialize stuff */
 	png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
 	if (png_ptr == NULL) {
 		fprintf(stderr, "png_create_write_struct() failed");
-		goto end2;
+		goto end1;
 	}
 
 	info_ptr = png_create_info_struct(png_ptr);
 	if (info_ptr == NULL) {
 		fprintf(stderr, "png_create_info_struct() failed");
-		goto end3;
+		goto end2;
 	}
 
 	if (setjmp(png_jmpbuf(png_ptr)) != 0) {
 		fprintf(stderr, "error in png code\n");
-		goto end4;
+		goto end2;
 	}
 
 	png_init_io(png_ptr, f);
+	if (level >= 0)
+		png_set_compression_level(png_ptr, level);
+	if (filters != 0)
+		png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, filters);
 
 	png_set_IHDR(png_ptr, info_ptr, w, h,
 		8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
 		PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
 
 	png_write_info(png_ptr, info_ptr);
-	png_write_image(png_ptr, row_pointers);
+	for (y = 0; y < h; y++) {
+		const void *line = (const char *)src + y * pitch;
+		unsigned char *dst = row;
+		if (bpp == 16) {
+			const unsigned short *p = line;
+			for (x = 0; x < w; x++, dst += 3) {
+				dst[0] = (p[x] & 0xf800) >> 8;
+				dst[1] = (p[x] & 0x07e0) >> 3;
+				dst[2] = (p[x] & 0x001f) << 3;
+			}
+		}
+		else {
+			const unsigned int *p = line;
+			for (x = 0; x < w; x++, dst += 3) {
+				dst[0] = p[x] >> 16;
+				dst[1] = p[x] >> 8;
+				dst[2] = p[x];
+			}
+		}
+		png_write_row(png_ptr, row);
+	}
 	png_write_end(png_ptr, NULL);
 
 	ret = 0;
 
-end4:
-//	png_destroy_info_struct(png_ptr, &info_ptr); // freed below
-end3:
-	png_destroy_write_struct(&png_ptr, &info_ptr);
 end2:
-	for (i = 0; i < h; i++)
-		free(row_pointers[i]);
-	free(row_pointers);
+	png_destroy_write_struct(&png_ptr, &info_ptr);
 end1:
+	free(row);
 	fclose(f);
 	return ret;
 }
-
@@ -7,6 +7,7 @@ typedef enum
 	READPNG_FONT,
 	READPNG_SELECTOR,
 	READPNG_24,
+	READPNG_BG32,	// like READPNG_BG, but XRGB8888
 }
 readpng_what;
 
@@ -17,6 +18,11 @@ extern "C" {
 int readpng(void *dest, const char *fname, readpng_what what, int w, int h);
 int writepng(const char *fname, unsigned short *src, int w, int h);
 
+/* bpp is 16 (RGB565) or 32 (XRGB8888), pitch is in bytes; level is the
+ * zlib level (-1: default), filters a PNG_FILTER_* mask (0: default) */
+int writepng_ex(const char *fname, const void *src, int w, int h, int bpp,
+		int pitch, int level, int filters);
+
 #ifdef __cplusplus
 }
 #endif
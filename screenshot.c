@@ -0,0 +1,236 @@
+/*
+ * background screenshot writer
+ *
+ * This work is licensed under the terms of any of these licenses
+ * (at your option):
+ *  - GNU GPL, version 2 or later.
+ *  - GNU LGPL, version 2.1 or later.
+ *  - MAME license.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "readpng.h"
+#include "screenshot.h"
+
+#define SCREENSHOT_BUFFERS 3
+#define SCREENSHOT_MAX_BUFFERS 16
+
+struct shot {
+	char fname[256];
+	void *pixels;
+	size_t alloc;
+	int w, h, bpp;
+	screenshot_done_cb *done;
+	void *arg;
+};
+
+static struct {
+	pthread_t thread;
+	int running;
+	int stop;
+	int level;
+	int filters;
+	unsigned int dropped;
+
+	// all below protected by the mutex, cond signals any change
+	struct shot shots[SCREENSHOT_MAX_BUFFERS];
+	int free_list[SCREENSHOT_MAX_BUFFERS];
+	int free_count;
+	int queue[SCREENSHOT_MAX_BUFFERS];
+	int q_head, q_len;
+	int busy;
+} ss;
+
+static pthread_mutex_t ss_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ss_cond = PTHREAD_COND_INITIALIZER;
+
+static int shot_write(struct shot *s)
+{
+	int ret;
+
+	ret = writepng_ex(s->fname, s->pixels, s->w, s->h, s->bpp,
+		s->w * s->bpp / 8, ss.level, ss.filters);
+	if (s->done != NULL)
+		s->done(s->fname, ret, s->arg);
+	return ret;
+}
+
+static void *screenshot_thread(void *arg)
+{
+	int i;
+
+	pthread_mutex_lock(&ss_mutex);
+	for (;;) {
+		while (ss.q_len == 0 && !ss.stop)
+			pthread_cond_wait(&ss_cond, &ss_mutex);
+		if (ss.q_len == 0)
+			break;
+
+		i = ss.queue[ss.q_head];
+		ss.q_head = (ss.q_head + 1) % SCREENSHOT_MAX_BUFFERS;
+		ss.q_len--;
+		ss.busy++;
+		pthread_mutex_unlock(&ss_mutex);
+
+		shot_write(&ss.shots[i]);
+
+		pthread_mutex_lock(&ss_mutex);
+		ss.free_list[ss.free_count++] = i;
+		ss.busy--;
+		pthread_cond_broadcast(&ss_cond);
+	}
+	pthread_mutex_unlock(&ss_mutex);
+
+	return NULL;
+}
+
+int screenshot_init(int buffers, int level, int filters)
+{
+	int i;
+
+	if (ss.running)
+		return 0;
+
+	if (buffers <= 0)
+		buffers = SCREENSHOT_BUFFERS;
+	if (buffers > SCREENSHOT_MAX_BUFFERS)
+		buffers = SCREENSHOT_MAX_BUFFERS;
+
+	ss.stop = 0;
+	ss.level = level;
+	ss.filters = filters;
+	ss.q_head = ss.q_len = ss.busy = 0;
+	ss.free_count = 0;
+	for (i = 0; i < buffers; i++)
+		ss.free_list[ss.free_count++] = i;
+
+	if (pthread_create(&ss.thread, NULL, screenshot_thread, NULL) != 0) {
+		fprintf(stderr, "screenshot: pthread_create failed\n");
+		return -1;
+	}
+	ss.running = 1;
+
+	return 0;
+}
+
+int screenshot_save(const char *fname, const void *src, int w, int h,
+	int bpp, int pitch, int flags, screenshot_done_cb *done, void *arg)
+{
+	size_t line = w * bpp / 8, size = line * h;
+	struct shot *s;
+	void *tmp;
+	int i, y;
+
+	if (bpp != 16 && bpp != 32)
+		return -1;
+
+	if (!ss.running)
+		screenshot_init(0, -1, 0);
+
+	pthread_mutex_lock(&ss_mutex);
+	while (ss.running && ss.free_count == 0) {
+		if (!(flags & SCREENSHOT_WAIT)) {
+			ss.dropped++;
+			pthread_mutex_unlock(&ss_mutex);
+			return -1;
+		}
+		pthread_cond_wait(&ss_cond, &ss_mutex);
+	}
+	// no thread, use the first buffer and write it right here
+	i = ss.running ? ss.free_list[--ss.free_count] : 0;
+	pthread_mutex_unlock(&ss_mutex);
+
+	s = &ss.shots[i];
+	if (s->alloc < size) {
+		tmp = realloc(s->pixels, size);
+		if (tmp == NULL) {
+			fprintf(stderr, "screenshot: OOM\n");
+			goto fail;
+		}
+		s->pixels = tmp;
+		s->alloc = size;
+	}
+
+	if (pitch == (int)line)
+		memcpy(s->pixels, src, size);
+	else
+		for (y = 0; y < h; y++)
+			memcpy((char *)s->pixels + y * line,
+				(const char *)src + y * pitch, line);
+
+	snprintf(s->fname, sizeof(s->fname), "%s", fname);
+	s->w = w;
+	s->h = h;
+	s->bpp = bpp;
+	s->done = done;
+	s->arg = arg;
+
+	if (!ss.running)
+		return shot_write(s);
+
+	pthread_mutex_lock(&ss_mutex);
+	ss.queue[(ss.q_head + ss.q_len) % SCREENSHOT_MAX_BUFFERS] = i;
+	ss.q_len++;
+	pthread_cond_broadcast(&ss_cond);
+	pthread_mutex_unlock(&ss_mutex);
+
+	return 0;
+
+fail:
+	if (ss.running) {
+		pthread_mutex_lock(&ss_mutex);
+		ss.free_list[ss.free_count++] = i;
+		pthread_cond_broadcast(&ss_cond);
+		pthread_mutex_unlock(&ss_mutex);
+	}
+	return -1;
+}
+
+int screenshot_pending(void)
+{
+	int ret;
+
+	pthread_mutex_lock(&ss_mutex);
+	ret = ss.q_len + ss.busy;
+	pthread_mutex_unlock(&ss_mutex);
+
+	return ret;
+}
+
+unsigned int screenshot_dropped(void)
+{
+	return ss.dropped;
+}
+
+void screenshot_flush(void)
+{
+	pthread_mutex_lock(&ss_mutex);
+	while (ss.q_len != 0 || ss.busy != 0)
+		pthread_cond_wait(&ss_cond, &ss_mutex);
+	pthread_mutex_unlock(&ss_mutex);
+}
+
+void screenshot_finish(void)
+{
+	int i;
+
+	if (ss.running) {
+		pthread_mutex_lock(&ss_mutex);
+		ss.stop = 1;
+		pthread_cond_broadcast(&ss_cond);
+		pthread_mutex_unlock(&ss_mutex);
+		pthread_join(ss.thread, NULL);
+		ss.running = 0;
+	}
+
+	for (i = 0; i < SCREENSHOT_MAX_BUFFERS; i++) {
+		free(ss.shots[i].pixels);
+		ss.shots[i].pixels = NULL;
+		ss.shots[i].alloc = 0;
+	}
+}
@@ -0,0 +1,34 @@
+#ifndef LIBPICOFE_SCREENSHOT_H
+#define LIBPICOFE_SCREENSHOT_H
+
+/* Screenshots written by a background thread. The caller only pays for
+ * copying the frame into a free buffer from a small pool, conversion
+ * and png compression happen on the worker. */
+
+#define SCREENSHOT_WAIT (1 << 0)	// block for a free buffer instead of dropping
+
+/* called on the worker thread once the file is written (ret 0) or failed */
+typedef void (screenshot_done_cb)(const char *fname, int ret, void *arg);
+
+/* starts the worker; buffers is the number of frames that may be queued
+ * (0: default), level/filters as for writepng_ex(). Does nothing if
+ * already running. */
+int  screenshot_init(int buffers, int level, int filters);
+
+/* queues src (bpp 16 or 32, pitch in bytes) to be written to fname.
+ * If all buffers are busy the frame is dropped and -1 returned, unless
+ * SCREENSHOT_WAIT is in flags. done may be NULL. */
+int  screenshot_save(const char *fname, const void *src, int w, int h,
+		int bpp, int pitch, int flags, screenshot_done_cb *done, void *arg);
+
+/* frames queued or being written, and frames dropped so far */
+int  screenshot_pending(void);
+unsigned int screenshot_dropped(void);
+
+/* waits for everything queued to be written */
+void screenshot_flush(void);
+
+/* flushes and stops the worker, frees the buffers */
+void screenshot_finish(void);
+
+#endif // LIBPICOFE_SCREENSHOT_H
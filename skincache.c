@@ -0,0 +1,289 @@
+/*
+ * cache of decoded skin assets
+ *
+ * This work is licensed under the terms of any of these licenses
+ * (at your option):
+ *  - GNU GPL, version 2 or later.
+ *  - GNU LGPL, version 2.1 or later.
+ *  - MAME license.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "posix.h"
+#include "skincache.h"
+
+#define SKINCACHE_MAGIC "PFSK"
+#define SKINCACHE_VERSION 1
+#define SKINCACHE_ALIGN 16
+
+/* file layout: header, entries[count], data; each entry's data is
+ * SKINCACHE_ALIGN aligned so it can be used from the map directly */
+struct skincache_hdr {
+	char magic[4];
+	unsigned int version;
+	unsigned int count;
+	unsigned int size;
+};
+
+struct skincache_ent {
+	char name[64];
+	long long mtime;
+	unsigned int mtime_ns;
+	unsigned int src_size;
+	unsigned int offset;
+	unsigned int size;
+};
+
+struct skincache_new {
+	struct skincache_ent ent;
+	void *data;
+	struct skincache_new *next;
+};
+
+struct skincache {
+	char fname[256];
+	void *map;
+	size_t map_size;
+	const struct skincache_ent *ents;
+	unsigned int count;
+	struct skincache_new *added;
+	int dirty;
+};
+
+static int skincache_stat(const char *src, struct skincache_ent *ent)
+{
+	struct stat st;
+
+	if (stat(src, &st) != 0)
+		return -1;
+	ent->mtime = st.st_mtime;
+#ifdef __linux__
+	ent->mtime_ns = st.st_mtim.tv_nsec;
+#else
+	ent->mtime_ns = 0;
+#endif
+	ent->src_size = st.st_size;
+	return 0;
+}
+
+struct skincache *skincache_open(const char *skin_dir)
+{
+	const struct skincache_hdr *hdr;
+	struct skincache *sc;
+	struct stat st;
+	unsigned int i;
+	int fd;
+
+	sc = calloc(1, sizeof(*sc));
+	if (sc == NULL)
+		return NULL;
+	snprintf(sc->fname, sizeof(sc->fname), "%sskin.cache", skin_dir);
+
+	fd = open(sc->fname, O_RDONLY);
+	if (fd < 0)
+		return sc;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*hdr))
+		goto out;
+	sc->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (sc->map == MAP_FAILED) {
+		sc->map = NULL;
+		goto out;
+	}
+	sc->map_size = st.st_size;
+
+	hdr = sc->map;
+	if (memcmp(hdr->magic, SKINCACHE_MAGIC, 4) != 0
+	    || hdr->version != SKINCACHE_VERSION || hdr->size != sc->map_size
+	    || sizeof(*hdr) + (size_t)hdr->count * sizeof(sc->ents[0]) > sc->map_size)
+		goto out;
+	sc->ents = (const void *)(hdr + 1);
+	for (i = 0; i < hdr->count; i++)
+		if (sc->ents[i].name[sizeof(sc->ents[i].name) - 1] != 0
+		    || sc->ents[i].offset > sc->map_size
+		    || sc->ents[i].size > sc->map_size - sc->ents[i].offset)
+			goto out;
+	sc->count = hdr->count;
+
+out:
+	close(fd);
+	return sc;
+}
+
+void skincache_close(struct skincache *sc)
+{
+	struct skincache_new *n;
+
+	if (sc == NULL)
+		return;
+	while ((n = sc->added) != NULL) {
+		sc->added = n->next;
+		free(n->data);
+		free(n);
+	}
+	if (sc->map != NULL)
+		munmap(sc->map, sc->map_size);
+	free(sc);
+}
+
+static int skincache_valid(const struct skincache_ent *ent, const char *name,
+	const struct skincache_ent *cur)
+{
+	return strcmp(ent->name, name) == 0 && ent->mtime == cur->mtime
+		&& ent->mtime_ns == cur->mtime_ns && ent->src_size == cur->src_size;
+}
+
+const void *skincache_get(struct skincache *sc, const char *name,
+	const char *src, size_t *size)
+{
+	struct skincache_ent cur;
+	struct skincache_new *n;
+	unsigned int i;
+
+	if (sc == NULL || skincache_stat(src, &cur) != 0)
+		return NULL;
+
+	for (n = sc->added; n != NULL; n = n->next) {
+		if (skincache_valid(&n->ent, name, &cur)) {
+			*size = n->ent.size;
+			return n->data;
+		}
+	}
+	for (i = 0; i < sc->count; i++) {
+		if (skincache_valid(&sc->ents[i], name, &cur)) {
+			*size = sc->ents[i].size;
+			return (const char *)sc->map + sc->ents[i].offset;
+		}
+	}
+
+	return NULL;
+}
+
+int skincache_put(struct skincache *sc, const char *name, const char *src,
+	const void *data, size_t size)
+{
+	struct skincache_new *n;
+
+	if (sc == NULL || strlen(name) >= sizeof(n->ent.name))
+		return -1;
+
+	n = calloc(1, sizeof(*n));
+	if (n == NULL)
+		return -1;
+	if (skincache_stat(src, &n->ent) != 0
+	    // FAT has 2s mtime resolution, see dircache_save()
+	    || time(NULL) - n->ent.mtime < 3)
+		goto fail;
+	n->data = malloc(size ? size : 1);
+	if (n->data == NULL)
+		goto fail;
+	memcpy(n->data, data, size);
+	strcpy(n->ent.name, name);
+	n->ent.size = size;
+	n->next = sc->added;
+	sc->added = n;
+	sc->dirty = 1;
+	return 0;
+
+fail:
+	free(n);
+	return -1;
+}
+
+int skincache_commit(struct skincache *sc)
+{
+	struct skincache_hdr hdr;
+	struct skincache_ent *ents = NULL;
+	const void **data = NULL;
+	struct skincache_new *n;
+	static const char pad[SKINCACHE_ALIGN];
+	char tmpname[264];
+	unsigned int i, j, count = 0, offset;
+	int ret = -1;
+	FILE *f = NULL;
+
+	if (sc == NULL || !sc->dirty)
+		return 0;
+
+	for (n = sc->added; n != NULL; n = n->next)
+		count++;
+	ents = calloc(count + sc->count, sizeof(ents[0]));
+	data = calloc(count + sc->count, sizeof(data[0]));
+	if (ents == NULL || data == NULL)
+		goto out;
+
+	// new entries, then old ones not replaced by them
+	count = 0;
+	for (n = sc->added; n != NULL; n = n->next) {
+		for (j = 0; j < count; j++)
+			if (strcmp(ents[j].name, n->ent.name) == 0)
+				break;
+		if (j < count)
+			continue; // put twice, the later one is first
+		ents[count] = n->ent;
+		data[count++] = n->data;
+	}
+	for (i = 0; i < sc->count; i++) {
+		for (j = 0; j < count; j++)
+			if (strcmp(ents[j].name, sc->ents[i].name) == 0)
+				break;
+		if (j < count)
+			continue;
+		ents[count] = sc->ents[i];
+		data[count++] = (const char *)sc->map + sc->ents[i].offset;
+	}
+
+	offset = sizeof(hdr) + count * sizeof(ents[0]);
+	for (i = 0; i < count; i++) {
+		offset = (offset + SKINCACHE_ALIGN - 1) & ~(SKINCACHE_ALIGN - 1);
+		ents[i].offset = offset;
+		offset += ents[i].size;
+	}
+	memcpy(hdr.magic, SKINCACHE_MAGIC, 4);
+	hdr.version = SKINCACHE_VERSION;
+	hdr.count = count;
+	hdr.size = offset;
+
+	// write and rename, the old file stays mapped until close
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp", sc->fname);
+	f = fopen(tmpname, "wb");
+	if (f == NULL)
+		goto out;
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1
+	    || fwrite(ents, sizeof(ents[0]), count, f) != count)
+		goto out;
+	offset = sizeof(hdr) + count * sizeof(ents[0]);
+	for (i = 0; i < count; i++) {
+		if (fwrite(pad, 1, ents[i].offset - offset, f) != ents[i].offset - offset
+		    || fwrite(data[i], 1, ents[i].size, f) != ents[i].size)
+			goto out;
+		offset = ents[i].offset + ents[i].size;
+	}
+	if (fclose(f) != 0) {
+		f = NULL;
+		goto out;
+	}
+	f = NULL;
+	if (rename(tmpname, sc->fname) != 0)
+		goto out;
+	sc->dirty = 0;
+	ret = 0;
+
+out:
+	if (f != NULL)
+		fclose(f);
+	if (ret != 0) {
+		fprintf(stderr, "skincache: failed to write %s\n", sc->fname);
+		remove(tmpname);
+	}
+	free(ents);
+	free(data);
+	return ret;
+}
@@ -0,0 +1,26 @@
+#ifndef LIBPICOFE_SKINCACHE_H
+#define LIBPICOFE_SKINCACHE_H
+
+#include <stddef.h>
+
+struct skincache;
+
+/* Build-once cache of decoded skin assets (backgrounds, glyph atlases,
+ * parsed colors), kept as skin.cache in the skin dir and mmap'd on
+ * open. Each entry is keyed by name and is valid while its source
+ * file's mtime and size are unchanged. */
+struct skincache *skincache_open(const char *skin_dir);
+void skincache_close(struct skincache *sc);
+
+/* returns the entry made from src, NULL if missing or stale;
+ * valid until skincache_close() */
+const void *skincache_get(struct skincache *sc, const char *name,
+		const char *src, size_t *size);
+
+/* data is copied, it's written out by skincache_commit() together
+ * with the entries still valid */
+int  skincache_put(struct skincache *sc, const char *name, const char *src,
+		const void *data, size_t size);
+int  skincache_commit(struct skincache *sc);
+
+#endif // LIBPICOFE_SKINCACHE_H